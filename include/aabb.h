@@ -73,6 +73,17 @@ class aabb {
             return y.size() > z.size() ? 1 : 2;
     }
 
+    double surface_area() const {
+        auto dx = x.size();
+        auto dy = y.size();
+        auto dz = z.size();
+        return 2 * (dx*dy + dy*dz + dz*dx);
+    }
+
+    point3 centroid() const {
+        return point3(0.5*(x.min + x.max), 0.5*(y.min + y.max), 0.5*(z.min + z.max));
+    }
+
     static const aabb empty, universe;
 
     private:
@@ -6,76 +6,305 @@
 #include "hittable_list.h"
 
 #include <algorithm>
+#include <vector>
+
+
+#ifdef BVH_STATS
+// Number of BVH nodes whose bounds were tested by the calling thread.
+inline thread_local unsigned long long bvh_node_visits = 0;
+#endif
+
+
+enum class bvh_split_method {
+    sah,     // binned surface area heuristic
+    median   // random axis, split at the object-count median
+};
+
+struct bvh_build_options {
+    bvh_split_method method = bvh_split_method::sah;
+    int    bin_count         = 16;    // SAH buckets per axis
+    size_t max_leaf_size     = 4;     // spans larger than this are always split
+    double traversal_cost    = 0.125; // cost of visiting one node...
+    double intersection_cost = 1.0;   // ...relative to one primitive test
+
+    // Flattened hierarchies (linear_bvh, wide_bvh) with at least parallel_min_size primitives
+    // build their subtrees on build_threads workers; 0 means one per hardware thread.
+    size_t build_threads     = 0;
+    size_t parallel_min_size = 16384;
+};
+
+// From depth bvh_sah_max_depth down, spans are split at the median, which halves them, so a
+// tree over fewer than 2^32 primitives has no leaf deeper than bvh_max_depth. The flattened
+// hierarchies size their traversal stacks from it.
+constexpr int bvh_max_depth = 64;
+constexpr int bvh_sah_max_depth = bvh_max_depth - 32;
+
+// A primitive as seen by the builders: its bounds, their centroid and the index of the
+// object in the caller's array.
+struct bvh_primitive {
+    aabb   box;
+    point3 centroid;
+    size_t index;
+};
+
+inline std::vector<bvh_primitive> bvh_primitives(const std::vector<shared_ptr<hittable>>& objects) {
+    std::vector<bvh_primitive> prims(objects.size());
+    for (size_t i = 0; i < objects.size(); i++) {
+        prims[i].box = objects[i]->bounding_box();
+        prims[i].centroid = prims[i].box.centroid();
+        prims[i].index = i;
+    }
+    return prims;
+}
+
+inline size_t bvh_median_split(std::vector<bvh_primitive>& prims, size_t start, size_t end) {
+    int axis = random_int(0,2);
+
+    size_t object_span = end - start;
+    if (object_span == 1)
+        return start;
+
+    std::sort(std::begin(prims) + start, std::begin(prims) + end,
+        [axis](const bvh_primitive& a, const bvh_primitive& b) {
+            return a.box.axis_interval(axis).min < b.box.axis_interval(axis).min;
+        });
+
+    return start + object_span/2;
+}
+
+inline size_t bvh_sah_split(
+    std::vector<bvh_primitive>& prims, size_t start, size_t end, const aabb& bounds,
+    const bvh_build_options& options
+) {
+    // Partitions prims[start,end) along the cheapest binned SAH plane and returns the
+    // split position, or `start` when the span is better off as a leaf.
+
+    size_t object_span = end - start;
+    if (object_span == 1)
+        return start;
+
+    aabb centroid_bounds;
+    for (size_t i = start; i < end; i++)
+        centroid_bounds = aabb(centroid_bounds, aabb(prims[i].centroid, prims[i].centroid));
+
+    struct bin {
+        aabb   box;
+        size_t count = 0;
+    };
+
+    const int bin_count = std::max(2, options.bin_count);
+    std::vector<bin> bins(bin_count);
+    std::vector<double> right_area(bin_count);
+    std::vector<size_t> right_count(bin_count);
+
+    auto best_cost = infinity;
+    int best_axis = -1;
+    int best_bin = 0;
+
+    for (int axis = 0; axis < 3; axis++) {
+        const interval& extent = centroid_bounds.axis_interval(axis);
+        if (extent.size() <= 0)
+            continue;
+
+        auto scale = bin_count / extent.size();
+        auto bin_index = [&](const bvh_primitive& p) {
+            int b = int((p.centroid[axis] - extent.min) * scale);
+            return b < bin_count ? b : bin_count - 1;
+        };
+
+        std::fill(bins.begin(), bins.end(), bin());
+        for (size_t i = start; i < end; i++) {
+            auto& b = bins[bin_index(prims[i])];
+            b.box = aabb(b.box, prims[i].box);
+            b.count++;
+        }
+
+        // Sweep from the right to collect the area and count of every right-hand side,
+        // then from the left to evaluate each of the bin_count-1 candidate planes.
+        aabb accum;
+        size_t count = 0;
+        for (int b = bin_count - 1; b > 0; b--) {
+            accum = aabb(accum, bins[b].box);
+            count += bins[b].count;
+            right_area[b] = count ? accum.surface_area() : 0;
+            right_count[b] = count;
+        }
+
+        accum = aabb();
+        count = 0;
+        for (int b = 0; b < bin_count - 1; b++) {
+            accum = aabb(accum, bins[b].box);
+            count += bins[b].count;
+            if (count == 0 || right_count[b+1] == 0)
+                continue;
+
+            auto cost = count * accum.surface_area() + right_count[b+1] * right_area[b+1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    if (best_axis < 0) {
+        // Every centroid coincides, so no plane separates them; fall back to an even split.
+        if (object_span <= options.max_leaf_size)
+            return start;
+        return start + object_span/2;
+    }
+
+    auto split_cost = options.traversal_cost
+                    + options.intersection_cost * best_cost / bounds.surface_area();
+    auto leaf_cost = options.intersection_cost * object_span;
+
+    if (object_span <= options.max_leaf_size && leaf_cost <= split_cost)
+        return start;
+
+    const interval& extent = centroid_bounds.axis_interval(best_axis);
+    auto scale = bin_count / extent.size();
+    auto mid = std::partition(std::begin(prims) + start, std::begin(prims) + end,
+        [&](const bvh_primitive& p) {
+            int b = int((p.centroid[best_axis] - extent.min) * scale);
+            return (b < bin_count ? b : bin_count - 1) <= best_bin;
+        });
+
+    return size_t(mid - std::begin(prims));
+}
+
+inline size_t bvh_split(
+    std::vector<bvh_primitive>& prims, size_t start, size_t end, const aabb& bounds,
+    const bvh_build_options& options, int depth
+) {
+    if (options.method == bvh_split_method::median)
+        return bvh_median_split(prims, start, end);
+    if (depth >= bvh_sah_max_depth)
+        return end - start <= options.max_leaf_size ? start : bvh_median_split(prims, start, end);
+    return bvh_sah_split(prims, start, end, bounds, options);
+}
+
 
 class bvh_node : public hittable {
   public:
-    bvh_node(hittable_list list) : bvh_node(list.objects, 0, list.objects.size()) {
+    bvh_node(hittable_list list, const bvh_build_options& options = {})
+      : bvh_node(list.objects, 0, list.objects.size(), options)
+    {
         // There's a C++ subtlety here. This constructor (without span indices) creates an
         // implicit copy of the hittable list, which we will modify. The lifetime of the copied
         // list only extends until this constructor exits. That's OK, because we only need to
         // persist the resulting bounding volume hierarchy.
     }
 
-    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
-                int axis = random_int(0,2);
+    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+             const bvh_build_options& options = {})
+    {
+        std::vector<shared_ptr<hittable>> span(std::begin(objects) + start, std::begin(objects) + end);
+        auto prims = bvh_primitives(span);
+        build(span, prims, 0, prims.size(), options, 0);
+    }
+
+    bvh_node(const std::vector<shared_ptr<hittable>>& objects, std::vector<bvh_primitive>& prims,
+             size_t start, size_t end, const bvh_build_options& options, int depth = 0)
+    {
+        build(objects, prims, start, end, options, depth);
+    }
 
-        auto comparator = (axis == 0) ? box_x_compare
-                        : (axis == 1) ? box_y_compare
-                                      : box_z_compare;
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!intersect(r, ray_t, rec))
+            return false;
+        finalize_hit(r, rec);
+        return true;
+    }
 
-        size_t object_span = end - start;
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+#ifdef BVH_STATS
+        bvh_node_visits++;
+#endif
+        if (!bbox.hit(r, ray_t))
+            return false;
 
-        if (object_span == 1) {
-            left = right = objects[start];
-        } else if (object_span == 2) {
-            left = objects[start];
-            right = objects[start+1];
-        } else {
-            std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
+        bool hit_left = left->intersect(r, ray_t, rec);
+        if (!right)
+            return hit_left;
 
-            auto mid = start + object_span/2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
+        bool hit_right = right->intersect(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+        return hit_left || hit_right;
+    }
+
+    void hit_packet(ray_packet& packet, uint32_t lanes, hit_record recs[]) const override {
+#ifdef BVH_STATS
+        bvh_node_visits++;
+#endif
+        uint32_t entering = 0;
+        for (uint32_t l = lanes; l; l &= l - 1) {
+            int i = __builtin_ctz(l);
+            if (bbox.hit(packet.rays[i], interval(packet.t_min, packet.t_max[i])))
+                entering |= 1u << i;
         }
+        if (!entering)
+            return;
 
-        bbox = aabb(left->bounding_box(), right->bounding_box());    
+        left->hit_packet(packet, entering, recs);
+        if (right)
+            right->hit_packet(packet, entering, recs);
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    bool occluded(const ray& r, interval ray_t) const override {
+#ifdef BVH_STATS
+        bvh_node_visits++;
+#endif
         if (!bbox.hit(r, ray_t))
             return false;
-
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
-
-        return hit_left || hit_right;
+        return left->occluded(r, ray_t) || (right && right->occluded(r, ray_t));
     }
 
     aabb bounding_box() const override { return bbox; }
 
 private:
+    friend class linear_bvh;
+
     shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
+    shared_ptr<hittable> right;  // null for leaves
     aabb bbox;
 
-    static bool box_compare(
-        const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index
-    ) {
-        auto a_axis_interval = a->bounding_box().axis_interval(axis_index);
-        auto b_axis_interval = b->bounding_box().axis_interval(axis_index);
-        return a_axis_interval.min < b_axis_interval.min;
-    }
+    void build(const std::vector<shared_ptr<hittable>>& objects, std::vector<bvh_primitive>& prims,
+               size_t start, size_t end, const bvh_build_options& options, int depth)
+    {
+        for (size_t i = start; i < end; i++)
+            bbox = aabb(bbox, prims[i].box);
+
+        auto mid = bvh_split(prims, start, end, bbox, options, depth);
+
+        if (mid == start) {
+            left = leaf(objects, prims, start, end);
+            return;
+        }
 
-    static bool box_x_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 0);
+        left = child(objects, prims, start, mid, options, depth + 1);
+        right = child(objects, prims, mid, end, options, depth + 1);
     }
 
-    static bool box_y_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 1);
+    static shared_ptr<hittable> child(
+        const std::vector<shared_ptr<hittable>>& objects, std::vector<bvh_primitive>& prims,
+        size_t start, size_t end, const bvh_build_options& options, int depth
+    ) {
+        if (end - start == 1)
+            return objects[prims[start].index];
+        return make_shared<bvh_node>(objects, prims, start, end, options, depth);
     }
 
-    static bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-        return box_compare(a, b, 2);
+    static shared_ptr<hittable> leaf(
+        const std::vector<shared_ptr<hittable>>& objects, const std::vector<bvh_primitive>& prims,
+        size_t start, size_t end
+    ) {
+        if (end - start == 1)
+            return objects[prims[start].index];
+
+        auto list = make_shared<hittable_list>();
+        for (size_t i = start; i < end; i++)
+            list->add(objects[prims[i].index]);
+        return list;
     }
 };
 #endif
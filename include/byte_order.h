@@ -0,0 +1,20 @@
+#ifndef BYTE_ORDER_H
+#define BYTE_ORDER_H
+
+#include <cstdint>
+#include <cstring>
+
+
+// "little" or "big": the order of the bytes of numbers written raw from this host's memory.
+inline const char* native_byte_order() {
+    const uint16_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first ? "little" : "big";
+}
+
+inline bool little_endian_host() {
+    return native_byte_order()[0] == 'l';
+}
+
+#endif
@@ -2,17 +2,29 @@
 #define CAMERA_H
 
 
+#include "checkpoint.h"
 #include "hittable.h"
 #include "material.h"
 #include "ray.h"
 #include "color.h"
+#include "framebuffer.h"
+#include "image_writer.h"
 #include "vec3.h"
-#include "threadpool.h"
+#include "scheduler.h"
+#include "tile.h"
 #include "pdf.h"
+#include "progress.h"
 
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
 #include <thread>
 #include <vector>
 
@@ -25,6 +37,9 @@ class camera {
         int image_width = 100;
         //count of random samples for each pixel
         int samples_per_pixel = 10;
+        // Where each sample's random numbers come from: "independent", "sobol" or "blue_noise"
+        // (sampler.h). The low-discrepancy samplers reach a given noise level with fewer samples.
+        std::string sampler = "sobol";
         //maximum number of ray bounces into scene
         int max_depth = 10;
         // Scene background color
@@ -39,96 +54,605 @@ class camera {
         double defocus_angle = 0;
         double focus_dist = 10;
 
+        // Every sample's random numbers are seeded from its pixel, its index and this frame
+        // number, so renders of the same frame are identical for any thread count or tiling.
+        int frame = 0;
+
+        // Primary rays of this many neighbouring pixels are traced as one packet (up to 16);
+        // 1 traces every ray on its own.
+        int packet_size = 1;
+
+        // Linear radiance of the last render, written to output_path when it finishes.
+        framebuffer image;
+        std::string output_path = "image.ppm";
+        // "p3", "ppm", "pfm" or "qoi"; empty picks the format from output_path's extension.
+        std::string output_format;
+
+        // When positive, the image is rendered in bands of this many rows, each written to
+        // output_path as soon as it and the rows above it are done; `image` is left empty. At
+        // most stream_bands_in_flight bands (0: two per thread) are held in memory at once.
+        int stream_band_rows = 0;
+        int stream_bands_in_flight = 0;
+
+        // The image is rendered in tile_size x tile_size tiles (0: one scanline at a time), their
+        // pixels visited in pixel_order ("hilbert", "morton" or "scanline"). Each tile is timed
+        // on tile_probe_rays paths first, and the slowest tiles are started first.
+        int tile_size = 16;
+        std::string pixel_order = "hilbert";
+        int tile_probe_rays = 4;
+        // Instead of probing, time one sample of every pixel, then split tiles that would take
+        // more than an eighth of a thread's share of the render into quarters.
+        bool cost_prepass = false;
+
+        // When positive, samples go where they are needed: every pixel gets adaptive_min_samples
+        // (at least 4; 0: a quarter of samples_per_pixel), then passes double the samples of the
+        // pixels whose mean brightness still has a standard error above adaptive_threshold times
+        // the mean, until those converge, reach adaptive_max_samples (0: 8x samples_per_pixel),
+        // or the image has used samples_per_pixel samples a pixel on average. Needs the whole
+        // image in memory, and traces no packets. If sample_map_path is set, the share of
+        // adaptive_max_samples each pixel took is written there as a gray image.
+        double adaptive_threshold = 0;
+        int adaptive_min_samples = 0;
+        int adaptive_max_samples = 0;
+        std::string sample_map_path;
+
+        // A progressive render adds passes of pass_samples samples to every pixel until each has
+        // samples_per_pixel, stopping early rather than start a pass that would end past
+        // time_budget seconds (0: no limit). It is used when time_budget or checkpoint_path is
+        // set. Every checkpoint_interval seconds, and at the end, the summed samples go to
+        // checkpoint_path and the image so far to output_path. With resume, the render carries
+        // on from the checkpoint an earlier render of the same scene left there; checkpoint_tag
+        // names the scene, and is checked along with the camera settings. The independent
+        // sampler's stratification grid is sized from samples_per_pixel, so with it a resume
+        // must keep the grid size, and a render stopped early has filled only part of the grid;
+        // the sobol and blue-noise samplers are stratified at any sample count.
+        double time_budget = 0;
+        int pass_samples = 1;
+        std::string checkpoint_path;
+        double checkpoint_interval = 60;
+        bool resume = false;
+        std::string checkpoint_tag;
+
+        // Progress goes to std::clog every progress_interval seconds from a reporter thread:
+        // "text" for a status line, "json" for one JSON object per line, or "none".
+        std::string progress_mode = "text";
+        double progress_interval = 1.0;
+
 
         /* Public Camera Parameters Here */
         void render(const hittable& world, int num_threads, const hittable& lights) {
             initialize();
+            progress.reset((long long)image_width * image_height);
+            const bool progressive = time_budget > 0 || !checkpoint_path.empty();
+            if (adaptive_threshold > 0 && stream_band_rows > 0)
+                throw std::runtime_error("Adaptive sampling cannot stream the image in bands");
+            if (progressive && (adaptive_threshold > 0 || stream_band_rows > 0))
+                throw std::runtime_error("Progressive rendering cannot sample adaptively or "
+                                         "stream the image in bands");
+            if (stream_band_rows > 0) {
+                render_streaming(world, num_threads, lights);
+                return;
+            }
 
-            std::ofstream file("image.ppm");
-
-            std::string** output = new std::string*[image_height];  // Allocate rows
-                for (int i = 0; i < image_height; ++i) {
-                output[i] = new std::string[image_width];  // Allocate columns for each row
+            image.resize(image_width, image_height);
+            {
+                task_scheduler scheduler(num_threads);
+                if (progressive) {
+                    render_progressive(world, lights, scheduler);
+                } else if (adaptive_threshold > 0) {
+                    render_adaptive(world, lights, scheduler);
+                } else if (tile_size > 0) {
+                    render_tiles(world, lights, scheduler);
+                } else {
+                    progress_reporter reporter(progress, progress_mode, progress_interval);
+                    scheduler.parallel_for(image_height, 1, [&](size_t begin, size_t end) {
+                        for (size_t j = begin; j < end; j++)
+                            render_line(world, int(j), lights, image, int(j));
+                    });
+                }
             }
 
-            std::vector<std::thread> threads;
+            std::clog << "Done!\n";
+            write_image(image, output_path, output_format, num_threads);
+        }
+
+        void render_streaming(const hittable& world, int num_threads, const hittable& lights) {
+            struct band {
+                int first_row;
+                framebuffer pixels;
+                std::atomic<int> lines_left;
+            };
+
+            image = framebuffer();
+            auto format = output_format.empty() ? image_format_from_path(output_path)
+                                                : image_format_from_name(output_format);
+            image_stream out(output_path, format, image_width, image_height);
+
+            // Rows are handed out top to bottom. A row of band k waits until `window` bands
+            // fewer than k have been written, so at most `window` bands are held at once, and
+            // each band written lets the next one start without waiting for its neighbours.
+            const int window = stream_bands_in_flight > 0 ? stream_bands_in_flight
+                                                          : 2 * std::max(1, num_threads);
+            std::vector<band> bands((image_height + stream_band_rows - 1) / stream_band_rows);
+            std::mutex mutex;
+            std::condition_variable band_written;
+            int bands_written = 0;
+
+            task_scheduler scheduler(num_threads);
+            progress_reporter reporter(progress, progress_mode, progress_interval);
+            scheduler.parallel_for_ordered(image_height, [&](size_t row) {
+                const int k = int(row) / stream_band_rows;
+                auto& b = bands[k];
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    band_written.wait(lock, [&] { return bands_written > k - window; });
+                    if (b.pixels.size() == 0) {
+                        b.first_row = k * stream_band_rows;
+                        b.pixels.resize(image_width,
+                                        std::min(stream_band_rows, image_height - b.first_row));
+                        b.lines_left = b.pixels.height;
+                    }
+                }
+
+                render_line(world, int(row), lights, b.pixels, int(row) - b.first_row);
+                if (--b.lines_left > 0)
+                    return;
 
+                int written = out.write_band(b.first_row, b.pixels);
+                b.pixels = framebuffer();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    bands_written += written;
+                }
+                band_written.notify_all();
+            });
 
-            ThreadPool pool(num_threads);
+            out.close();
+            std::clog << "Done!\n";
+        }
 
-            file << "P3\n" << image_width << ' ' << image_height << "\n255\n";
 
-            for (int j = 0; j < image_height; j++) {
-                int assigned_line = j;
-                pool.enqueue(([this, &world, output, assigned_line, &lights]()
-                        { render_line(world, output, assigned_line, lights); }));
+        void render_progressive(const hittable& world, const hittable& lights,
+                                task_scheduler& scheduler)
+        {
+            using clock = std::chrono::steady_clock;
+            const auto start = clock::now();
+            auto seconds_since = [](clock::time_point t) {
+                return std::chrono::duration<double>(clock::now() - t).count();
+            };
+
+            render_checkpoint state;
+            state.width = image_width;
+            state.height = image_height;
+            state.fingerprint = fingerprint();
+            state.sums.assign(image.size() * 3, 0.0);
+            if (resume) {
+                render_checkpoint saved;
+                if (!load_checkpoint(checkpoint_path, saved)) {
+                    std::clog << "No checkpoint at " << checkpoint_path << ", starting afresh\n";
+                } else if (saved.fingerprint != state.fingerprint || saved.width != image_width
+                           || saved.height != image_height) {
+                    throw std::runtime_error("Checkpoint " + checkpoint_path
+                                             + " is from another scene or camera");
+                } else {
+                    state = std::move(saved);
+                    std::clog << "Resuming at " << state.samples << " samples per pixel\n";
+                }
             }
 
-            pool.waitUntilDone();
-
-            for (int i = 0; i < image_height; i++)
+            // Samples are summed in the same order as pixel_color sums them, so a finished
+            // progressive render, resumed or not, is the image a one-pass render would give.
+            auto update_image = [&] {
+                double scale = 1.0 / std::max(1, state.samples);
+                for (size_t p = 0; p < image.size(); p++) {
+                    const double* sum = &state.sums[p * 3];
+                    image.set(p, color(sum[0], sum[1], sum[2]) * scale);
+                }
+            };
+            auto save = [&] {
+                update_image();
+                save_checkpoint(state, checkpoint_path);
+                write_image(image, output_path, output_format, int(scheduler.size()));
+            };
+
+            const int step = std::max(1, pass_samples);
+            const int passes_left = (std::max(0, samples_per_pixel - state.samples) + step - 1)
+                                  / step;
+            progress.reset((long long)image.size() * passes_left);
+
+            int passes = 0;
+            double last_pass = 0;
+            auto last_checkpoint = start;
             {
-                for(int j = 0; j < image_width; j++)
-                {
-                    file << output[i][j];
+                progress_reporter reporter(progress, progress_mode, progress_interval);
+                while (state.samples < samples_per_pixel) {
+                    if (time_budget > 0 && passes > 0
+                        && seconds_since(start) + last_pass > time_budget)
+                        break;
+
+                    const int first = state.samples;
+                    const int last = std::min(first + step, samples_per_pixel);
+                    auto pass_start = clock::now();
+                    scheduler.parallel_for(image_height, 1, [&](size_t begin, size_t end) {
+                        for (size_t j = begin; j < end; j++) {
+                            long rays = 0;
+                            for (int i = 0; i < image_width; i++) {
+                                double* sum = &state.sums[(j * image_width + i) * 3];
+                                for (int s = first; s < last; s++) {
+                                    seed_sample(i, int(j), s);
+                                    color c = ray_color(get_ray(i, int(j), s), max_depth, world,
+                                                        lights, &rays);
+                                    sum[0] += c.x();
+                                    sum[1] += c.y();
+                                    sum[2] += c.z();
+                                }
+                            }
+                            progress.add(image_width, (long long)image_width * (last - first),
+                                         rays);
+                        }
+                    });
+                    state.samples = last;
+                    last_pass = seconds_since(pass_start);
+                    passes++;
+
+                    if (!checkpoint_path.empty() && state.samples < samples_per_pixel
+                        && seconds_since(last_checkpoint) >= checkpoint_interval) {
+                        save();
+                        last_checkpoint = clock::now();
+                    }
                 }
             }
 
+            update_image();
+            if (!checkpoint_path.empty())
+                save_checkpoint(state, checkpoint_path);
+            std::clog << "Progressive: " << passes << " passes in " << seconds_since(start)
+                      << " s, " << state.samples << " of " << samples_per_pixel
+                      << " samples per pixel\n";
+        }
+
+        void render_adaptive(const hittable& world, const hittable& lights,
+                             task_scheduler& scheduler)
+        {
+            const size_t pixel_count = image.size();
+            const int max_samples = adaptive_max_samples > 0 ? adaptive_max_samples
+                                                             : 8 * samples_per_pixel;
+            const int min_samples = std::min(std::max(4, adaptive_min_samples > 0
+                                                             ? adaptive_min_samples
+                                                             : samples_per_pixel / 4),
+                                             max_samples);
+            long long budget = (long long)samples_per_pixel * pixel_count;
+
+            // Running sum of each pixel's samples, and Welford's mean and sum of squared
+            // deviations of their brightness.
+            std::vector<color>   sums(pixel_count);
+            std::vector<double>  means(pixel_count), squares(pixel_count);
+            std::vector<uint8_t> finished(pixel_count, 0);  // 1: converged, 2: at max_samples
+            std::vector<int>     samples(pixel_count, 0);
+            std::vector<uint8_t> below(pixel_count, 0);     // error below the threshold
+
+            // Every pixel still sampling has had the same `count` samples, so a pass is one
+            // parallel loop over them, and each pixel's samples are the same for any thread count.
+            std::vector<uint32_t> active(pixel_count);
+            for (size_t p = 0; p < pixel_count; p++)
+                active[p] = uint32_t(p);
+            int count = 0, step = min_samples, passes = 0;
+
+            {
+                progress_reporter reporter(progress, progress_mode, progress_interval);
+                while (!active.empty() && step > 0) {
+                    const int total = count + step;
+                    scheduler.parallel_for(active.size(), 64, [&](size_t begin, size_t end) {
+                        long rays = 0;
+                        for (size_t k = begin; k < end; k++) {
+                            auto p = active[k];
+                            int i = int(p % image_width), j = int(p / image_width);
+                            for (int s = count; s < total; s++) {
+                                seed_sample(i, j, s);
+                                color c = ray_color(get_ray(i, j, s), max_depth, world, lights,
+                                                    &rays);
+                                sums[p] += c;
+                                double x = (c.x() + c.y() + c.z()) / 3;
+                                double delta = x - means[p];
+                                means[p] += delta / (s + 1);
+                                squares[p] += delta * (x - means[p]);
+                            }
+                            image.set(p, sums[p] / total);
+                            samples[p] = total;
+
+                            // Standard error of the mean, relative to the mean or to 0.01 for
+                            // pixels darker than that.
+                            double error = std::sqrt(squares[p] / (double(total - 1) * total));
+                            below[p] = error <= adaptive_threshold * std::max(means[p], 0.01);
+                        }
+                        progress.add(0, (long long)(end - begin) * step, rays);
+                    });
+
+                    // A pixel stops once it and its neighbours are all below the threshold, so a
+                    // few lucky samples in a noisy region do not end it early.
+                    scheduler.parallel_for(active.size(), 256, [&](size_t begin, size_t end) {
+                        long long stopped = 0;
+                        for (size_t k = begin; k < end; k++) {
+                            auto p = active[k];
+                            int i = int(p % image_width), j = int(p / image_width);
+                            bool quiet = true;
+                            int x0 = std::max(0, i - 1), x1 = std::min(image_width - 1, i + 1);
+                            int y0 = std::max(0, j - 1), y1 = std::min(image_height - 1, j + 1);
+                            for (int y = y0; y <= y1; y++)
+                                for (int x = x0; x <= x1; x++)
+                                    quiet = quiet && below[size_t(y) * image_width + x];
+                            if (quiet)
+                                finished[p] = 1;
+                            else if (total >= max_samples)
+                                finished[p] = 2;
+                            stopped += finished[p] != 0;
+                        }
+                        progress.add(stopped, 0, 0);
+                    });
+
+                    budget -= (long long)active.size() * step;
+                    count = total;
+                    passes++;
+                    active.erase(std::remove_if(active.begin(), active.end(),
+                                                [&](uint32_t p) { return finished[p] != 0; }),
+                                 active.end());
+                    if (!active.empty())
+                        step = int(std::min<long long>({count, max_samples - count,
+                                                        budget / (long long)active.size()}));
+                }
+                progress.add((long long)active.size(), 0, 0);  // left when the budget ran out
+            }
 
-            std::clog << "\nDone!\n";
-            file.close();
+            long long converged = 0;
+            for (auto f : finished)
+                converged += f == 1;
+            std::clog << "Adaptive: " << passes << " passes, "
+                      << double((long long)samples_per_pixel * pixel_count - budget) / pixel_count
+                      << " samples per pixel on average, "
+                      << 100.0 * converged / pixel_count << "% of pixels converged\n";
+
+            if (!sample_map_path.empty()) {
+                framebuffer map;
+                map.resize(image_width, image_height);
+                for (size_t p = 0; p < pixel_count; p++) {
+                    double share = double(samples[p]) / max_samples;
+                    map.set(p, color(share, share, share));
+                }
+                write_image(map, sample_map_path, "", int(scheduler.size()));
+            }
         }
 
+        void render_tiles(const hittable& world, const hittable& lights,
+                          task_scheduler& scheduler)
+        {
+            const auto order = tile_pixel_order(tile_size, pixel_order);
+
+            std::vector<tile> tiles;
+            for (int y = 0; y < image_height; y += tile_size)
+                for (int x = 0; x < image_width; x += tile_size)
+                    tiles.push_back({x, y, std::min(x + tile_size, image_width),
+                                     std::min(y + tile_size, image_height)});
+
+            if (cost_prepass) {
+                prepass_costs(world, lights, scheduler, tiles);
+            } else if (tile_probe_rays > 0) {
+                scheduler.parallel_for(tiles.size(), 1, [&](size_t begin, size_t end) {
+                    for (size_t t = begin; t < end; t++)
+                        tiles[t].cost = probe_cost(world, lights, tiles[t]);
+                });
+            }
+            std::stable_sort(tiles.begin(), tiles.end(),
+                             [](const tile& a, const tile& b) { return a.cost > b.cost; });
+
+            using clock = std::chrono::steady_clock;
+            const auto start = clock::now();
+            std::atomic<long long> busy_ns(0), last_start_ns(0);
+
+            {
+                progress_reporter reporter(progress, progress_mode, progress_interval);
+                scheduler.parallel_for_ordered(tiles.size(), [&](size_t t) {
+                    auto tile_start = clock::now();
+                    long long started = std::chrono::nanoseconds(tile_start - start).count();
+                    for (auto seen = last_start_ns.load(); seen < started; )
+                        last_start_ns.compare_exchange_weak(seen, started);
+
+                    render_tile(world, lights, tiles[t], order);
+                    busy_ns += std::chrono::nanoseconds(clock::now() - tile_start).count();
+                });
+            }
 
-        void render_line(const hittable& world, std::string **output, int j, const hittable& lights)
+            // Utilization is the share of worker time spent inside tiles; the tail is how long
+            // the render ran on after the last tile was handed out.
+            double wall = std::chrono::duration<double>(clock::now() - start).count();
+            std::clog << "Tiles: " << tiles.size() << ", utilization "
+                      << 100.0 * busy_ns.load() * 1e-9 / (wall * scheduler.size()) << "% of "
+                      << scheduler.size() << " threads, tail "
+                      << wall - last_start_ns.load() * 1e-9 << " s\n";
+        }
+
+        void prepass_costs(const hittable& world, const hittable& lights,
+                           task_scheduler& scheduler, std::vector<tile>& tiles) const
         {
-            // Pre-calculate these values outside all loops
-            const int samples = sqrt_spp * sqrt_spp;
-            const double inv_samples = 1.0 / samples;
-            color* color_arr = new color[samples];
-            
-            for (int i = 0; i < image_width; i++) {
-                color pixel_color(0,0,0);
-                std::fill_n(color_arr, samples, color(0,0,0));
-                
-                for (int s_i = 0; s_i < sqrt_spp; s_i++) {
-                    for (int s_j = 0; s_j < sqrt_spp; s_j++) {
-                        sample_color(world, i, j, s_i, s_j, color_arr, lights);
+            // One timed sample per pixel gives a cost map. Its samples are not kept; at the usual
+            // sample counts the pass costs a few percent of the render.
+            std::vector<float> cost_map(size_t(image_width) * image_height);
+            scheduler.parallel_for(tiles.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t k = begin; k < end; k++) {
+                    auto& t = tiles[k];
+                    for (int j = t.y0; j < t.y1; j++) {
+                        for (int i = t.x0; i < t.x1; i++) {
+                            auto start = std::chrono::steady_clock::now();
+                            ray_color(get_ray(i, j, random_int(0, samples_per_pixel - 1)),
+                                      max_depth, world, lights, &t.rays);
+                            cost_map[size_t(j) * image_width + i] = std::chrono::duration<float>(
+                                std::chrono::steady_clock::now() - start).count();
+                        }
                     }
                 }
+            });
+
+            auto cost_of = [&](const tile& t) {
+                double sum = 0;
+                for (int j = t.y0; j < t.y1; j++)
+                    for (int i = t.x0; i < t.x1; i++)
+                        sum += cost_map[size_t(j) * image_width + i];
+                return sum;
+            };
+
+            double total = 0;
+            long rays = 0;
+            for (auto& t : tiles) {
+                t.cost = cost_of(t);
+                total += t.cost;
+                rays += t.rays;
+            }
+
+            // Quarter any tile above the limit, and its quarters in turn, down to 4 pixels a side.
+            const double limit = total / (8 * scheduler.size());
+            const size_t initial = tiles.size();
+            for (size_t k = 0; k < tiles.size(); k++) {
+                tile t = tiles[k];
+                if (t.cost <= limit || t.x1 - t.x0 < 8 || t.y1 - t.y0 < 8)
+                    continue;
+
+                int mx = (t.x0 + t.x1) / 2, my = (t.y0 + t.y1) / 2;
+                tile quarters[4] = {{t.x0, t.y0, mx, my}, {mx, t.y0, t.x1, my},
+                                    {t.x0, my, mx, t.y1}, {mx, my, t.x1, t.y1}};
+                for (auto& q : quarters)
+                    q.cost = cost_of(q);
+                tiles[k] = quarters[0];
+                tiles.insert(tiles.end(), quarters + 1, quarters + 4);
+                k--;
+            }
+
+            std::clog << "Pre-pass: " << rays << " rays, " << total << " s traced, "
+                      << (tiles.size() - initial) / 3 << " tiles split\n";
+        }
+
+        void render_tile(const hittable& world, const hittable& lights, const tile& t,
+                         const std::vector<std::pair<int, int>>& order)
+        {
+            // Pixels go to the packet renderer in runs along the curve, which keeps each packet
+            // a compact cluster of neighbours.
+            const int width = std::min(packet_size, ray_packet::max_size);
+            pixel_coord run[ray_packet::max_size];
+            int count = 0;
+            long rays = 0;
+
+            for (const auto& offset : order) {
+                int i = t.x0 + offset.first;
+                int j = t.y0 + offset.second;
+                if (i >= t.x1 || j >= t.y1)
+                    continue;
 
-                // Use faster addition method
-                for (int sample = 0; sample < samples; sample++) {
-                    pixel_color += color_arr[sample];
+                if (width <= 1) {
+                    image.set(i, j, pixel_color(world, i, j, lights, &rays));
+                    continue;
+                }
+                run[count++] = {i, j};
+                if (count == width) {
+                    render_packet(world, lights, run, count, image, 0, &rays);
+                    count = 0;
                 }
+            }
+            if (count > 0)
+                render_packet(world, lights, run, count, image, 0, &rays);
+
+            long long pixels = (long long)(t.x1 - t.x0) * (t.y1 - t.y0);
+            progress.add(pixels, pixels * samples_per_pixel, rays);
+        }
 
-                // Use pre-calculated inverse instead of multiplication
-                pixel_color *= inv_samples;
-                output[j][i] = write_color(pixel_color);
+        double probe_cost(const hittable& world, const hittable& lights, const tile& t) const {
+            // Seconds to trace tile_probe_rays paths through random pixels of the tile.
+            auto start = std::chrono::steady_clock::now();
+            for (int k = 0; k < tile_probe_rays; k++) {
+                int i = random_int(t.x0, t.x1 - 1);
+                int j = random_int(t.y0, t.y1 - 1);
+                ray_color(get_ray(i, j, random_int(0, samples_per_pixel - 1)), max_depth, world,
+                          lights);
             }
-            
-            delete[] color_arr;
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
         }
 
-        void sample_color(const hittable& world, int i, int j, int s_i, int s_j,
-                color color_arr[], const hittable& lights)
+        void render_line(const hittable& world, int j, const hittable& lights,
+                         framebuffer& target, int target_row)
         {
-            // Calculate the index in the color array based on the grid position
-            int sample = s_i * sqrt_spp + s_j;
-            ray r = get_ray(i, j, s_i, s_j);
-            color_arr[sample] = ray_color(r, max_depth, world, lights);
+            // Renders image row j into row target_row of target.
+            long rays = 0;
+            if (packet_size > 1) {
+                const int width = std::min(packet_size, ray_packet::max_size);
+                pixel_coord run[ray_packet::max_size];
+                for (int i0 = 0; i0 < image_width; i0 += width) {
+                    int count = std::min(width, image_width - i0);
+                    for (int k = 0; k < count; k++)
+                        run[k] = {i0 + k, j};
+                    render_packet(world, lights, run, count, target, j - target_row, &rays);
+                }
+            } else {
+                for (int i = 0; i < image_width; i++)
+                    target.set(i, target_row, pixel_color(world, i, j, lights, &rays));
+            }
+
+            progress.add(image_width, (long long)image_width * samples_per_pixel, rays);
         }
 
+        color pixel_color(const hittable& world, int i, int j, const hittable& lights,
+                          long* rays = nullptr) const {
+            color sum(0,0,0);
+            for (int s = 0; s < samples_per_pixel; s++) {
+                seed_sample(i, j, s);
+                sum += ray_color(get_ray(i, j, s), max_depth, world, lights, rays);
+            }
+            return sum * pixel_samples_scale;
+        }
+
+        void render_packet(const hittable& world, const hittable& lights,
+                           const pixel_coord* pixels, int count, framebuffer& target,
+                           int first_row, long* rays = nullptr)
+        {
+            // Each packet holds the same sub-pixel sample of up to 16 neighbouring pixels, so its
+            // rays start together and diverge only slightly. Only the first hit is found as a
+            // packet; the rest of each path is traced one ray at a time. Pixel (i, j) is stored
+            // at row j - first_row of target.
+            color pixel_colors[ray_packet::max_size];
+            sample_stream lane_random[ray_packet::max_size];  // each lane's own random stream
+
+            for (int s = 0; s < samples_per_pixel; s++) {
+                ray_packet packet;
+                for (int k = 0; k < count; k++) {
+                    seed_sample(pixels[k].i, pixels[k].j, s);
+                    packet.add(get_ray(pixels[k].i, pixels[k].j, s));
+                    lane_random[k] = save_random();
+                }
+
+                hit_record recs[ray_packet::max_size];
+                world.hit_packet(packet, packet.all(), recs);
 
+                for (int k = 0; k < count; k++) {
+                    restore_random(lane_random[k]);
+                    bool hit = packet.hits >> k & 1;
+                    pixel_colors[k] += path_color(packet.rays[k], hit, recs[k], max_depth,
+                                                  world, lights, rays);
+                }
+            }
 
+            for (int k = 0; k < count; k++)
+                target.set(pixels[k].i, pixels[k].j - first_row,
+                           pixel_colors[k] * pixel_samples_scale);
+        }
 
     private:
+        friend class wavefront_renderer;
+
+        render_progress progress;
+
         /* Private Camera Variables Here */
 
         int    image_height;        // Rendered image height
         double pixel_samples_scale; //Color scale factor for a sum of pixel samples
-        int    sqrt_spp;             // Square root of number of samples per pixel
+        int    sqrt_spp;             // Side of the stratification grid of the independent sampler
         double recip_sqrt_spp;       // 1 / sqrt_spp
+        sampler_type sampler_kind;   // Parsed from sampler
         point3 center;              // Camera center
         point3 pixel00_loc;         // Location of pixel 0, 0
         vec3   pixel_delta_u;       // Offset to pixel to the right
@@ -142,9 +666,11 @@ class camera {
             image_height = (image_height < 1) ? 1 : image_height;
 
 
+            samples_per_pixel = std::max(1, samples_per_pixel);
+            pixel_samples_scale = 1.0 / samples_per_pixel;
             sqrt_spp = int(std::sqrt(samples_per_pixel));
-            pixel_samples_scale = 1.0 / (sqrt_spp * sqrt_spp);
             recip_sqrt_spp = 1.0 / sqrt_spp;
+            sampler_kind = sampler_type_from_name(sampler);
 
             center = lookfrom;
 
@@ -179,10 +705,36 @@ class camera {
             defocus_disk_v = v * defocus_radius;
         }
 
-        ray get_ray(int i, int j, int s_i, int s_j) const {
-        // Construct a camera ray originating from the defocus disk and directed at a randomly
-        // sampled point around the pixel location i, j.
-        auto offset = sample_square_stratified(s_i, s_j);
+        uint64_t fingerprint() const {
+            // Everything a checkpoint's samples depend on besides the scene contents, including
+            // the independent sampler's stratification grid.
+            std::ostringstream settings;
+            settings.precision(17);
+            settings << checkpoint_tag << '|' << image_width << ' ' << image_height << ' '
+                     << max_depth << ' ' << sampler << ' ' << frame << ' ' << vfov << ' '
+                     << lookfrom << ' ' << lookat << ' ' << vup << ' ' << defocus_angle << ' '
+                     << focus_dist << ' ' << background;
+            if (sampler_kind == sampler_type::independent)
+                settings << ' ' << sqrt_spp;
+            return fingerprint_of(settings.str());
+        }
+
+        void seed_sample(int i, int j, int s) const {
+            random_stream.start(sampler_kind, i, j, uint64_t(j) * image_width + i, uint32_t(s),
+                                uint64_t(frame));
+        }
+
+        ray get_ray(int i, int j, int s) const {
+        // Construct a camera ray for sample s of pixel i, j, originating from the defocus disk
+        // and directed at a sampled point around the pixel location. The independent sampler
+        // stratifies the first sqrt_spp^2 samples on a grid; the others are stratified already.
+        vec3 offset;
+        if (sampler_kind != sampler_type::independent)
+            offset = sample_square();
+        else if (s < sqrt_spp * sqrt_spp)
+            offset = sample_square_stratified(s / sqrt_spp, s % sqrt_spp);
+        else
+            offset = sample_square();
         auto pixel_sample = pixel00_loc
                           + ((i + offset.x()) * pixel_delta_u)
                           + ((j + offset.y()) * pixel_delta_v);
@@ -207,7 +759,8 @@ class camera {
 
         vec3 sample_square() const {
             // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
-            return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+            auto [px, py] = random_double2();
+            return vec3(px - 0.5, py - 0.5, 0);
         }
 
 
@@ -220,15 +773,31 @@ class camera {
         }
 
 
-        color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights) const {
+        color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights,
+                        long* rays = nullptr) const {
+            if (depth <= 0)
+                return color(0,0,0);
+
+            hit_record rec;
+            bool hit = world.hit(r, interval(0.001, infinity), rec);
+            return path_color(r, hit, rec, depth, world, lights, rays);
+        }
+
+        color path_color(const ray& r, bool hit, hit_record rec, int depth, const hittable& world,
+                         const hittable& lights, long* rays = nullptr) const {
+            // Continues a path whose first intersection (`hit`, `rec`) is already known. If
+            // `rays` is given, it is incremented for every ray the path traces.
             ray current_ray = r;
             color final_color(0,0,0);
             color attenuation(1,1,1);
             
             for (int current_depth = depth; current_depth > 0; current_depth--) {
-                hit_record rec;
-                
-                if (!world.hit(current_ray, interval(0.001, infinity), rec)) {
+                if (current_depth != depth)
+                    hit = world.hit(current_ray, interval(0.001, infinity), rec);
+                if (rays)
+                    ++*rays;
+
+                if (!hit) {
                     final_color += attenuation * background;
                     break;
                 }
@@ -250,8 +819,8 @@ class camera {
                 }
 
                 // Create light PDF with current hit point
-                auto light_pdf = make_shared<hittable_pdf>(lights, rec.p);
-                mixture_pdf p(light_pdf, srec.pdf_ptr);
+                hittable_pdf light_pdf(lights, rec.p);
+                mixture_pdf p(light_pdf, as_pdf(srec.scatter_pdf));
 
                 ray scattered = ray(rec.p, p.generate(), current_ray.time());
                 auto pdf_value = p.value(scattered.direction());
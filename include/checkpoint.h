@@ -0,0 +1,91 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "byte_order.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+// The state of a progressive render between passes: the sum of every pixel's samples, kept in
+// doubles so that a resumed render adds up to exactly what an uninterrupted one would, and the
+// number of samples each pixel has had. `fingerprint` identifies the scene and camera settings
+// the samples belong to; a checkpoint is only resumed into a render with the same one.
+struct render_checkpoint {
+    int width = 0;
+    int height = 0;
+    int samples = 0;  // per pixel; progressive passes give every pixel the same number
+    uint64_t fingerprint = 0;
+    std::vector<double> sums;  // three per pixel, rows from the top down
+};
+
+inline uint64_t fingerprint_of(const std::string& text) {
+    // 64-bit FNV-1a, stable across compilers and runs unlike std::hash.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// File layout: a text header
+// "RTCHECKPOINT 2\n<width> <height> <samples> <fingerprint> <byte order>\n", then the sums as
+// raw doubles in the writer's native byte order, which a reader on a host of the other order
+// refuses. Written to a temporary file and renamed over `path`, so a render killed while saving
+// leaves the previous checkpoint intact.
+inline bool save_checkpoint(const render_checkpoint& checkpoint, const std::string& path) {
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file << "RTCHECKPOINT 2\n" << checkpoint.width << ' ' << checkpoint.height << ' '
+             << checkpoint.samples << ' ' << checkpoint.fingerprint << ' '
+             << native_byte_order() << '\n';
+        file.write(reinterpret_cast<const char*>(checkpoint.sums.data()),
+                   std::streamsize(checkpoint.sums.size() * sizeof(double)));
+        if (!file) {
+            std::cerr << "ERROR: Could not write checkpoint: " << temporary << std::endl;
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::cerr << "ERROR: Could not write checkpoint: " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Returns false if there is no checkpoint at `path`; throws if the file is not a checkpoint.
+inline bool load_checkpoint(const std::string& path, render_checkpoint& checkpoint) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    std::string magic, header, byte_order;
+    std::getline(file, magic);
+    std::getline(file, header);
+    std::istringstream fields(header);
+    if (magic != "RTCHECKPOINT 2"
+        || !(fields >> checkpoint.width >> checkpoint.height >> checkpoint.samples
+                    >> checkpoint.fingerprint >> byte_order)
+        || checkpoint.width <= 0 || checkpoint.height <= 0 || checkpoint.samples < 0)
+        throw std::runtime_error("Not a render checkpoint: " + path);
+    if (byte_order != native_byte_order())
+        throw std::runtime_error("Render checkpoint from a " + byte_order + "-endian host: "
+                                 + path);
+
+    checkpoint.sums.resize(size_t(checkpoint.width) * checkpoint.height * 3);
+    file.read(reinterpret_cast<char*>(checkpoint.sums.data()),
+              std::streamsize(checkpoint.sums.size() * sizeof(double)));
+    if (!file)
+        throw std::runtime_error("Truncated render checkpoint: " + path);
+    return true;
+}
+
+#endif
@@ -4,6 +4,8 @@
 #include "interval.h"
 #include "vec3.h"
 
+#include <cstdint>
+
 
 using color = vec3;
 
@@ -18,32 +20,13 @@ inline double linear_to_gamma(double linear_component)
 }
 
 
-std::string write_color(const color& pixel_color) {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-
-
-    // Replace NaN components with zero.
-    if (r != r) r = 0.0;
-    if (g != g) g = 0.0;
-    if (b != b) b = 0.0;
+inline uint8_t color_to_byte(double linear_component) {
+    // Replace NaN with zero.
+    if (linear_component != linear_component) linear_component = 0.0;
 
-    // apply linear to gamma transform for gamma 2
-    r = linear_to_gamma(r);
-    g = linear_to_gamma(g);
-    b = linear_to_gamma(b);
-
-
-    // Translate the [0,1] component values to the byte range [0,255].
+    // apply linear to gamma transform for gamma 2, then translate the [0,1] value to [0,255].
     static const interval intensity(0.000,0.999);
-    int rbyte = int(255.999 * intensity.clamp(r));
-    int gbyte = int(255.999 * intensity.clamp(g));
-    int bbyte = int(255.999 * intensity.clamp(b));
-
-    // Write out the pixel color components.
-    return std::to_string(rbyte) + ' ' +std::to_string(gbyte) + ' ' + std::to_string(bbyte) + '\n';
+    return uint8_t(255.999 * intensity.clamp(linear_to_gamma(linear_component)));
 }
 
 #endif
@@ -0,0 +1,54 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.h"
+
+#include <cstdint>
+#include <vector>
+
+
+// Linear RGB radiance of every pixel, three floats each, rows from the top of the image down.
+// Renderers fill it concurrently, each pixel from one thread only; quantizing to 8-bit and
+// encoding the file (image_writer.h) are separate passes over the finished image.
+class framebuffer {
+  public:
+    int width = 0;
+    int height = 0;
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        pixels.assign(size_t(w) * h * 3, 0.0f);
+    }
+
+    size_t size() const { return size_t(width) * height; }
+
+    void set(size_t index, const color& c) {
+        float* p = &pixels[index * 3];
+        p[0] = float(c.x());
+        p[1] = float(c.y());
+        p[2] = float(c.z());
+    }
+
+    void set(int i, int j, const color& c) { set(size_t(j) * width + i, c); }
+
+    color get(int i, int j) const {
+        const float* p = &pixels[(size_t(j) * width + i) * 3];
+        return color(p[0], p[1], p[2]);
+    }
+
+    const float* data() const { return pixels.data(); }
+
+    // Gamma-corrected 8-bit RGB, three bytes a pixel in the same order as the floats.
+    std::vector<uint8_t> quantize() const {
+        std::vector<uint8_t> bytes(pixels.size());
+        for (size_t k = 0; k < pixels.size(); k++)
+            bytes[k] = color_to_byte(pixels[k]);
+        return bytes;
+    }
+
+  private:
+    std::vector<float> pixels;
+};
+
+#endif
@@ -6,20 +6,31 @@
 #include "ray.h"
 #include "interval.h"
 #include "aabb.h"
+#include "ray_packet.h"
+
+#include <type_traits>
 
 
 class material;
+class hittable;
 
+// Records are copied and overwritten on every candidate hit, so they hold only plain values.
+// `mat` does not own its material: the primitives that hand it out keep it alive.
 class hit_record {
   public:
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;
+    const material* mat;
     double t;
     double u;
     double v;
     bool front_face;
 
+    // Set by intersect() for finalize_hit(); see hittable::intersect.
+    const hittable* object;    // primitive whose finalize() completes the record
+    const hittable* instance;  // transform around `object`, finalized in its place
+    uint32_t prim_id;          // primitive within `object`, e.g. a mesh triangle
+
    void set_face_normal(const ray& r, const vec3& outward_normal) {
         // Sets the hit record normal vector.
         // NOTE: the parameter `outward_normal` is assumed to have unit length.
@@ -30,6 +41,9 @@ class hit_record {
 
 };
 
+static_assert(std::is_trivially_copyable<hit_record>::value,
+              "hit_record is copied on every closer hit and must stay trivially copyable");
+
 class hittable {
     public:
     virtual ~hittable() = default;
@@ -38,6 +52,39 @@ class hittable {
             interval ray_t,
             hit_record& rec) const = 0;
 
+    // Two-phase closest hit. intersect() finds the closest hit in ray_t but records only t,
+    // the primitive (object, prim_id) and its surface coordinates (u, v); finalize_hit() then
+    // computes the point, normal, texture coordinates and material of that one hit, so
+    // surfaces that lose to a closer one never pay for shading data. Objects that don't split
+    // the work return a finished record with object == nullptr.
+    virtual bool intersect(const ray& r, interval ray_t, hit_record& rec) const {
+        if (!hit(r, ray_t, rec))
+            return false;
+        rec.object = nullptr;
+        rec.instance = nullptr;
+        return true;
+    }
+
+    // Completes a record this object produced in intersect().
+    virtual void finalize(const ray& r, hit_record& rec) const {}
+
+    // Any-hit query for visibility tests: true if anything is hit within ray_t. Stops at the
+    // first hit found and computes no shading data.
+    virtual bool occluded(const ray& r, interval ray_t) const {
+        hit_record rec;
+        return hit(r, ray_t, rec);
+    }
+
+    // Closest-hit query for the packet lanes in `lanes`. A lane's record is only written when
+    // its hit is closer than packet.t_max, which then shrinks to it.
+    virtual void hit_packet(ray_packet& packet, uint32_t lanes, hit_record recs[]) const {
+        for (; lanes; lanes &= lanes - 1) {
+            int i = __builtin_ctz(lanes);
+            if (hit(packet.rays[i], interval(packet.t_min, packet.t_max[i]), recs[i]))
+                packet.record_hit(i, recs[i].t);
+        }
+    }
+
     virtual aabb bounding_box() const = 0;
 
     virtual vec3 random(const point3& origin) const { return vec3(1,0,0); }
@@ -48,6 +95,14 @@ class hittable {
 };
 
 
+inline void finalize_hit(const ray& r, hit_record& rec) {
+    if (rec.instance)
+        rec.instance->finalize(r, rec);
+    else if (rec.object)
+        rec.object->finalize(r, rec);
+}
+
+
 class translate : public hittable {
   public:
     translate(shared_ptr<hittable> object, const vec3& offset)
@@ -72,6 +127,10 @@ class translate : public hittable {
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(ray(r.origin() - offset, r.direction(), r.time()), ray_t);
+    }
+
 
     aabb bounding_box() const override { return bbox; }
 
@@ -120,19 +179,7 @@ class rotate_y : public hittable {
 
         // Transform the ray from world space to object space.
 
-        auto origin = point3(
-            (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
-            r.origin().y(),
-            (sin_theta * r.origin().x()) + (cos_theta * r.origin().z())
-        );
-
-        auto direction = vec3(
-            (cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
-            r.direction().y(),
-            (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
-        );
-
-        ray rotated_r(origin, direction, r.time());
+        ray rotated_r = to_object(r);
 
         // Determine whether an intersection exists in object space (and if so, where).
 
@@ -156,6 +203,10 @@ class rotate_y : public hittable {
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(to_object(r), ray_t);
+    }
+
     aabb bounding_box() const override { return bbox; }
 
     private:
@@ -163,6 +214,22 @@ class rotate_y : public hittable {
         double sin_theta;
         double cos_theta;
         aabb bbox;
+
+        ray to_object(const ray& r) const {
+            auto origin = point3(
+                (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
+                r.origin().y(),
+                (sin_theta * r.origin().x()) + (cos_theta * r.origin().z())
+            );
+
+            auto direction = vec3(
+                (cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
+                r.direction().y(),
+                (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
+            );
+
+            return ray(origin, direction, r.time());
+        }
 };
 
 #endif
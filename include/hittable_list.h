@@ -29,12 +29,19 @@ class hittable_list : public hittable {
     bool hit(const ray& r, 
             interval ray_t, 
             hit_record& rec) const override {
+        if (!intersect(r, ray_t, rec))
+            return false;
+        finalize_hit(r, rec);
+        return true;
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
         hit_record temp_rec;
         bool hit_anything = false;
         auto closest_so_far = ray_t.max;
 
         for (const auto& object : objects) {
-            if (object->hit(r, 
+            if (object->intersect(r, 
                         interval(ray_t.min, closest_so_far),
                         temp_rec)) 
             {
@@ -47,6 +54,19 @@ class hittable_list : public hittable {
         return hit_anything;
     }
 
+    void hit_packet(ray_packet& packet, uint32_t lanes, hit_record recs[]) const override {
+        for (const auto& object : objects)
+            object->hit_packet(packet, lanes, recs);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        for (const auto& object : objects) {
+            if (object->occluded(r, ray_t))
+                return true;
+        }
+        return false;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
 
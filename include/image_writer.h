@@ -0,0 +1,283 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "byte_order.h"
+#include "framebuffer.h"
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+// Encoders for a finished framebuffer:
+//
+//   p3   plain PPM, 8-bit gamma-corrected text
+//   ppm  binary PPM (P6), 8-bit gamma-corrected
+//   pfm  Portable Float Map, the linear floats unchanged, for HDR post-processing
+//   qoi  "Quite OK Image", lossless and compressed, encoded in row strips across threads
+enum class image_format { p3, ppm, pfm, qoi };
+
+inline image_format image_format_from_name(const std::string& name) {
+    if (name == "p3")                  return image_format::p3;
+    if (name == "ppm" || name == "p6") return image_format::ppm;
+    if (name == "pfm")                 return image_format::pfm;
+    if (name == "qoi")                 return image_format::qoi;
+    throw std::runtime_error("Unknown image format '" + name + "'");
+}
+
+inline image_format image_format_from_path(const std::string& path) {
+    auto dot = path.find_last_of('.');
+    if (dot == std::string::npos)
+        return image_format::ppm;
+    std::string extension = path.substr(dot + 1);
+    for (auto& c : extension)
+        c = char(std::tolower(static_cast<unsigned char>(c)));
+    return image_format_from_name(extension);
+}
+
+
+inline std::string image_header(image_format format, int width, int height) {
+    std::string size = std::to_string(width) + ' ' + std::to_string(height);
+    switch (format) {
+        case image_format::p3:  return "P3\n" + size + "\n255\n";
+        case image_format::ppm: return "P6\n" + size + "\n255\n";
+        // The floats are written in the host's byte order; a negative scale marks little-endian.
+        case image_format::pfm:
+            return "PF\n" + size + (little_endian_host() ? "\n-1.0\n" : "\n1.0\n");
+        case image_format::qoi: break;
+    }
+
+    std::string header = "qoif";
+    for (uint32_t value : {uint32_t(width), uint32_t(height)})
+        for (int shift = 24; shift >= 0; shift -= 8)
+            header.push_back(char(value >> shift & 0xff));
+    header.push_back(3);  // RGB
+    header.push_back(0);  // sRGB
+    return header;
+}
+
+inline std::string image_trailer(image_format format) {
+    return format == image_format::qoi ? std::string("\0\0\0\0\0\0\0\1", 8) : std::string();
+}
+
+
+inline void append_p3(const std::vector<uint8_t>& bytes, std::string& out) {
+    // Formatted in place; "255 255 255\n" is the longest pixel.
+    size_t used = out.size();
+    out.resize(used + bytes.size() / 3 * 12);
+
+    char* p = &out[used];
+    for (size_t k = 0; k < bytes.size(); k++) {
+        unsigned value = bytes[k];
+        if (value >= 100) *p++ = char('0' + value / 100);
+        if (value >= 10)  *p++ = char('0' + value / 10 % 10);
+        *p++ = char('0' + value % 10);
+        *p++ = (k % 3 == 2) ? '\n' : ' ';
+    }
+    out.resize(p - out.data());
+}
+
+inline void append_pfm(const framebuffer& rows, std::string& out) {
+    // PFM stores rows from the bottom of the image up.
+    size_t row_bytes = size_t(rows.width) * 3 * sizeof(float);
+    size_t used = out.size();
+    out.resize(used + row_bytes * rows.height);
+    for (int j = 0; j < rows.height; j++) {
+        const float* row = rows.data() + size_t(rows.height - 1 - j) * rows.width * 3;
+        std::memcpy(&out[used + row_bytes * j], row, row_bytes);
+    }
+}
+
+
+// One run of rows encoded as QOI chunks. A decoder carries its previous pixel and index across
+// strips, so every strip opens with an explicit RGB pixel and only refers to index entries it
+// set itself; a decoder that reaches the strip has the same values in those entries.
+inline void append_qoi_strip(const uint8_t* pixels, size_t count, std::string& out) {
+    uint8_t index[64][3];
+    uint64_t valid = 0;
+    const uint8_t* prev = nullptr;
+    int run = 0;
+
+    auto flush_run = [&] {
+        if (run > 0) {
+            out.push_back(char(0xc0 | (run - 1)));
+            run = 0;
+        }
+    };
+
+    for (size_t k = 0; k < count; k++) {
+        const uint8_t* px = pixels + k * 3;
+        if (prev && px[0] == prev[0] && px[1] == prev[1] && px[2] == prev[2]) {
+            if (++run == 62)
+                flush_run();
+            continue;
+        }
+        flush_run();
+
+        int slot = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+        if (prev && (valid >> slot & 1) && std::memcmp(index[slot], px, 3) == 0) {
+            out.push_back(char(slot));
+        } else {
+            std::memcpy(index[slot], px, 3);
+            valid |= uint64_t(1) << slot;
+
+            int dr = prev ? int8_t(px[0] - prev[0]) : 0;
+            int dg = prev ? int8_t(px[1] - prev[1]) : 0;
+            int db = prev ? int8_t(px[2] - prev[2]) : 0;
+            int dr_dg = dr - dg, db_dg = db - dg;
+
+            if (prev && dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out.push_back(char(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+            } else if (prev && dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7
+                       && db_dg >= -8 && db_dg <= 7) {
+                out.push_back(char(0x80 | (dg + 32)));
+                out.push_back(char((dr_dg + 8) << 4 | (db_dg + 8)));
+            } else {
+                out.push_back(char(0xfe));
+                out.append(reinterpret_cast<const char*>(px), 3);
+            }
+        }
+        prev = px;
+    }
+    flush_run();
+}
+
+// The pixel data of `rows`, a run of whole image rows, without the file header or trailer.
+// Bands encoded separately concatenate to the body of the whole image (for PFM, in reverse).
+inline std::string encode_rows(const framebuffer& rows, image_format format, int num_threads = 1) {
+    std::string data;
+    if (format == image_format::pfm) {
+        append_pfm(rows, data);
+        return data;
+    }
+
+    auto bytes = rows.quantize();
+    switch (format) {
+        case image_format::p3:
+            append_p3(bytes, data);
+            break;
+        case image_format::ppm:
+            data.assign(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+            break;
+        case image_format::qoi: {
+            // A few strips per thread, each at least a few rows, so strip openings cost little.
+            // One thread encodes a single strip, without starting a scheduler.
+            const size_t pixels = rows.size();
+            size_t strips = num_threads > 1 ? std::min<size_t>(size_t(num_threads) * 4,
+                                                               std::max<size_t>(1, rows.height / 8))
+                                            : 1;
+            if (strips == 1) {
+                append_qoi_strip(bytes.data(), pixels, data);
+                break;
+            }
+
+            std::vector<std::string> encoded(strips);
+            {
+                task_scheduler scheduler(std::max(1, num_threads));
+                scheduler.parallel_for(strips, 1, [&](size_t begin, size_t end) {
+                    for (size_t s = begin; s < end; s++) {
+                        size_t first = pixels * s / strips;
+                        size_t last = pixels * (s + 1) / strips;
+                        encoded[s].reserve((last - first) * 2);
+                        append_qoi_strip(bytes.data() + first * 3, last - first, encoded[s]);
+                    }
+                });
+            }
+            for (const auto& strip : encoded)
+                data += strip;
+            break;
+        }
+        case image_format::pfm:
+            break;
+    }
+    return data;
+}
+
+
+inline void write_image(const framebuffer& image, const std::string& path, image_format format,
+                        int num_threads = 1) {
+    std::ofstream file(path, std::ios::binary);
+    file << image_header(format, image.width, image.height)
+         << encode_rows(image, format, num_threads)
+         << image_trailer(format);
+    if (!file)
+        std::cerr << "ERROR: Could not write image: " << path << std::endl;
+}
+
+// Format from `format_name` if given, otherwise from the extension of `path`.
+inline void write_image(const framebuffer& image, const std::string& path,
+                        const std::string& format_name, int num_threads = 1) {
+    auto format = format_name.empty() ? image_format_from_path(path)
+                                      : image_format_from_name(format_name);
+    write_image(image, path, format, num_threads);
+}
+
+
+// Writes an image band by band while it is still being rendered. Bands of whole rows may arrive
+// in any order and from any thread. Each is encoded by the calling thread, then written once
+// every row above it is on disk; PFM rows have a fixed size, so PFM bands go straight to their
+// offset in the file instead.
+class image_stream {
+  public:
+    image_stream(const std::string& path, image_format format, int width, int height)
+      : path(path), format(format), width(width), height(height),
+        file(path, std::ios::binary)
+    {
+        file << image_header(format, width, height);
+        header_bytes = file.tellp();
+    }
+
+    // Returns the number of bands that reached the file, this one and any it released.
+    int write_band(int first_row, const framebuffer& band) {
+        std::string data = encode_rows(band, format, 1);  // one strip, on this thread
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (format == image_format::pfm) {
+            size_t row_bytes = size_t(width) * 3 * sizeof(float);
+            file.seekp(header_bytes + std::streamoff(row_bytes * (height - first_row - band.height)));
+            file.write(data.data(), std::streamsize(data.size()));
+            rows_written += band.height;
+            return 1;
+        }
+
+        pending[first_row] = {band.height, std::move(data)};
+        int written = 0;
+        for (auto next = pending.begin(); next != pending.end() && next->first == rows_written;
+             next = pending.erase(next), written++) {
+            file.write(next->second.second.data(), std::streamsize(next->second.second.size()));
+            rows_written += next->second.first;
+        }
+        return written;
+    }
+
+    void close() {
+        if (format == image_format::pfm)
+            file.seekp(0, std::ios::end);
+        file << image_trailer(format);
+        file.close();
+        if (!file || rows_written != height)
+            std::cerr << "ERROR: Could not write image: " << path << std::endl;
+    }
+
+  private:
+    std::string   path;
+    image_format  format;
+    int           width, height;
+    std::ofstream file;
+    std::streamoff header_bytes = 0;
+
+    std::mutex    mutex;
+    int           rows_written = 0;
+    std::map<int, std::pair<int, std::string>> pending;  // first row -> (rows, encoded data)
+};
+
+#endif
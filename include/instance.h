@@ -0,0 +1,218 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+// A 3x4 affine transform: a linear part in columns 0-2 and a translation in column 3.
+class affine {
+  public:
+    double m[3][4];
+
+    affine() : m{{1,0,0,0}, {0,1,0,0}, {0,0,1,0}} {}
+
+    static affine translation(const vec3& offset) {
+        affine a;
+        for (int i = 0; i < 3; i++) a.m[i][3] = offset[i];
+        return a;
+    }
+
+    static affine scaling(const vec3& s) {
+        affine a;
+        for (int i = 0; i < 3; i++) a.m[i][i] = s[i];
+        return a;
+    }
+
+    static affine rotation(int axis, double degrees) {
+        // Right-handed rotation about the x (0), y (1) or z (2) axis.
+        auto radians = degrees_to_radians(degrees);
+        auto c = std::cos(radians);
+        auto s = std::sin(radians);
+        int i = (axis + 1) % 3;
+        int j = (axis + 2) % 3;
+
+        affine a;
+        a.m[i][i] = c;  a.m[i][j] = -s;
+        a.m[j][i] = s;  a.m[j][j] = c;
+        return a;
+    }
+
+    point3 point(const point3& p) const {
+        return point3(
+            m[0][0]*p[0] + m[0][1]*p[1] + m[0][2]*p[2] + m[0][3],
+            m[1][0]*p[0] + m[1][1]*p[1] + m[1][2]*p[2] + m[1][3],
+            m[2][0]*p[0] + m[2][1]*p[1] + m[2][2]*p[2] + m[2][3]
+        );
+    }
+
+    vec3 vector(const vec3& v) const {
+        return vec3(
+            m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+            m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+            m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]
+        );
+    }
+
+    vec3 transposed_vector(const vec3& v) const {
+        // Multiplies by the transpose of the linear part. Applied with the inverse transform,
+        // this carries surface normals.
+        return vec3(
+            m[0][0]*v[0] + m[1][0]*v[1] + m[2][0]*v[2],
+            m[0][1]*v[0] + m[1][1]*v[1] + m[2][1]*v[2],
+            m[0][2]*v[0] + m[1][2]*v[1] + m[2][2]*v[2]
+        );
+    }
+
+    affine inverse() const {
+        // Inverts the linear part by cofactors, then maps the translation back through it.
+        // Throws if the linear part is singular (or nearly), e.g. a zero scale.
+        auto det = m[0][0] * (m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                 - m[0][1] * (m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                 + m[0][2] * (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        double size = 0;
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                size = std::max(size, std::fabs(m[i][j]));
+        if (!(std::fabs(det) > 1e-12 * size * size * size))
+            throw std::runtime_error("Cannot invert a singular transform");
+        auto inv_det = 1.0 / det;
+
+        affine a;
+        a.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+        a.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv_det;
+        a.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+        a.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv_det;
+        a.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+        a.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv_det;
+        a.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+        a.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv_det;
+        a.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+
+        auto t = a.vector(vec3(m[0][3], m[1][3], m[2][3]));
+        for (int i = 0; i < 3; i++) a.m[i][3] = -t[i];
+        return a;
+    }
+};
+
+inline affine operator*(const affine& a, const affine& b) {
+    // The transform that applies b first, then a.
+    affine c;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            c.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+        }
+        c.m[i][3] += a.m[i][3];
+    }
+    return c;
+}
+
+
+// Places a shared, read-only object in the world through an affine transform. Any number of
+// instances may reference the same object (typically a mesh with its own BVH), so the geometry
+// and its hierarchy are stored once however many copies are rendered.
+class instance : public hittable {
+  public:
+    instance(shared_ptr<const hittable> object, const affine& object_to_world,
+             shared_ptr<material> mat = nullptr)
+      : object(object), object_to_world(object_to_world),
+        world_to_object(object_to_world.inverse()), mat(mat)
+    {
+        auto box = object->bounding_box();
+
+        point3 min( infinity,  infinity,  infinity);
+        point3 max(-infinity, -infinity, -infinity);
+
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                for (int k = 0; k < 2; k++) {
+                    auto corner = object_to_world.point(point3(
+                        i ? box.x.max : box.x.min,
+                        j ? box.y.max : box.y.min,
+                        k ? box.z.max : box.z.min
+                    ));
+
+                    for (int c = 0; c < 3; c++) {
+                        min[c] = std::fmin(min[c], corner[c]);
+                        max[c] = std::fmax(max[c], corner[c]);
+                    }
+                }
+            }
+        }
+
+        bbox = aabb(min, max);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!intersect(r, ray_t, rec))
+            return false;
+        finalize(r, rec);
+        return true;
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        ray object_r = to_object(r);
+        if (!object->intersect(object_r, ray_t, rec))
+            return false;
+
+        // A record holds one transform; a nested instance's hit is completed right away.
+        if (rec.instance) {
+            rec.instance->finalize(object_r, rec);
+            rec.object = nullptr;
+        }
+        rec.instance = this;
+        return true;
+    }
+
+    void finalize(const ray& r, hit_record& rec) const override {
+        if (rec.object)
+            rec.object->finalize(to_object(r), rec);
+
+        rec.p = object_to_world.point(rec.p);
+        rec.normal = unit_vector(world_to_object.transposed_vector(rec.normal));
+        if (mat)
+            rec.mat = mat.get();
+    }
+
+    void hit_packet(ray_packet& packet, uint32_t lanes, hit_record recs[]) const override {
+        ray_packet local;
+        local.t_min = packet.t_min;
+        for (int i = 0; i < packet.size; i++)
+            local.add(to_object(packet.rays[i]), packet.t_max[i]);
+
+        object->hit_packet(local, lanes, recs);
+
+        for (uint32_t found = local.hits; found; found &= found - 1) {
+            int i = __builtin_ctz(found);
+            recs[i].p = object_to_world.point(recs[i].p);
+            recs[i].normal = unit_vector(world_to_object.transposed_vector(recs[i].normal));
+            if (mat)
+                recs[i].mat = mat.get();
+            packet.record_hit(i, local.t_max[i]);
+        }
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(to_object(r), ray_t);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+  private:
+    shared_ptr<const hittable> object;
+    affine object_to_world;
+    affine world_to_object;
+    shared_ptr<material> mat;  // overrides the object's own material when set
+    aabb bbox;
+
+    ray to_object(const ray& r) const {
+        // The object-space direction is left unnormalized so t means the same in both spaces.
+        return ray(world_to_object.point(r.origin()), world_to_object.vector(r.direction()),
+                   r.time());
+    }
+};
+
+#endif
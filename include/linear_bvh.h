@@ -0,0 +1,449 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "scheduler.h"
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// One node of a flattened BVH. Interior nodes store their first child immediately after
+// themselves and the second child at `offset`; leaves store `count` primitives starting at
+// `offset`. Bounds are single precision, rounded outwards so they never shrink.
+struct linear_bvh_node {
+    float    bounds[2][3];  // [0] = min corner, [1] = max corner
+    uint32_t offset;        // first primitive (leaf) or second child (interior)
+    uint16_t count;         // primitive count, 0 for interior nodes
+    uint8_t  axis;          // axis the children were split along
+    uint8_t  pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill half a cache line");
+
+
+inline void set_node_bounds(linear_bvh_node& node, const aabb& box) {
+    for (int axis = 0; axis < 3; axis++) {
+        const interval& ax = box.axis_interval(axis);
+        float lo = float(ax.min);
+        float hi = float(ax.max);
+        if (double(lo) > ax.min) lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+        if (double(hi) < ax.max) hi = std::nextafter(hi, std::numeric_limits<float>::infinity());
+        node.bounds[0][axis] = lo;
+        node.bounds[1][axis] = hi;
+    }
+}
+
+inline uint8_t separating_axis(const std::vector<bvh_primitive>& prims, size_t start, size_t mid,
+                               size_t end)
+{
+    // The axis along which the two child spans' centroids are furthest apart, used to pick
+    // the near child during traversal.
+    point3 left_sum, right_sum;
+    for (size_t i = start; i < mid; i++) left_sum += prims[i].centroid;
+    for (size_t i = mid; i < end; i++) right_sum += prims[i].centroid;
+
+    auto delta = right_sum / double(end - mid) - left_sum / double(mid - start);
+    int axis = 0;
+    for (int a = 1; a < 3; a++)
+        if (std::fabs(delta[a]) > std::fabs(delta[axis])) axis = a;
+    return uint8_t(axis);
+}
+
+inline uint32_t build_linear_bvh(
+    std::vector<bvh_primitive>& prims, size_t start, size_t end, const bvh_build_options& options,
+    std::vector<linear_bvh_node>& nodes, int depth
+) {
+    // Appends the subtree over prims[start,end), whose root is at `depth`, to `nodes` in
+    // depth-first order and returns the index of its root. On return prims[start,end) is in
+    // leaf order.
+
+    aabb bounds;
+    for (size_t i = start; i < end; i++)
+        bounds = aabb(bounds, prims[i].box);
+
+    uint32_t index = uint32_t(nodes.size());
+    nodes.emplace_back();
+    set_node_bounds(nodes[index], bounds);
+
+    auto mid = bvh_split(prims, start, end, bounds, options, depth);
+
+    if (mid == start) {
+        nodes[index].offset = uint32_t(start);
+        nodes[index].count = uint16_t(end - start);
+        return index;
+    }
+
+    nodes[index].axis = separating_axis(prims, start, mid, end);
+    build_linear_bvh(prims, start, mid, options, nodes, depth + 1);
+    auto second = build_linear_bvh(prims, mid, end, options, nodes, depth + 1);
+    nodes[index].offset = second;
+    return index;
+}
+
+
+// The upper levels of a tree being built in parallel, in depth-first order. Each entry is either
+// an interior node or a subtree that a worker builds into its own node array.
+struct parallel_bvh_plan {
+    struct entry {
+        aabb    bounds;
+        uint8_t axis;
+        int     subtree;  // index into spans/subtrees, or -1 for an interior node
+    };
+
+    struct span {
+        size_t start, end;
+        int    depth;  // of the subtree's root
+    };
+
+    std::vector<entry> entries;
+    std::vector<span> spans;
+    std::vector<std::vector<linear_bvh_node>> subtrees;
+};
+
+inline void plan_parallel_bvh(
+    parallel_bvh_plan& plan, std::vector<bvh_primitive>& prims, size_t start, size_t end,
+    size_t subtree_size, const bvh_build_options& options, int depth
+) {
+    if (end - start > subtree_size) {
+        aabb bounds;
+        for (size_t i = start; i < end; i++)
+            bounds = aabb(bounds, prims[i].box);
+
+        auto mid = bvh_split(prims, start, end, bounds, options, depth);
+        if (mid != start) {
+            plan.entries.push_back({ bounds, separating_axis(prims, start, mid, end), -1 });
+            plan_parallel_bvh(plan, prims, start, mid, subtree_size, options, depth + 1);
+            plan_parallel_bvh(plan, prims, mid, end, subtree_size, options, depth + 1);
+            return;
+        }
+    }
+
+    plan.entries.push_back({ aabb(), 0, int(plan.spans.size()) });
+    plan.spans.push_back({ start, end, depth });
+}
+
+inline uint32_t stitch_parallel_bvh(
+    const parallel_bvh_plan& plan, size_t& next, std::vector<linear_bvh_node>& nodes
+) {
+    const auto& e = plan.entries[next++];
+
+    if (e.subtree >= 0) {
+        // Subtree nodes only need their child links rebased; leaf offsets already index the
+        // shared primitive array.
+        uint32_t base = uint32_t(nodes.size());
+        for (auto node : plan.subtrees[e.subtree]) {
+            if (node.count == 0) node.offset += base;
+            nodes.push_back(node);
+        }
+        return base;
+    }
+
+    uint32_t index = uint32_t(nodes.size());
+    nodes.emplace_back();
+    set_node_bounds(nodes[index], e.bounds);
+    nodes[index].axis = e.axis;
+
+    stitch_parallel_bvh(plan, next, nodes);
+    auto second = stitch_parallel_bvh(plan, next, nodes);
+    nodes[index].offset = second;
+    return index;
+}
+
+inline void build_linear_bvh(
+    std::vector<bvh_primitive>& prims, const bvh_build_options& options,
+    std::vector<linear_bvh_node>& nodes
+) {
+    // Builds the whole tree over prims, splitting the work across threads when the input is
+    // large enough to pay for it. The top levels are partitioned on the calling thread until
+    // there are a few subtrees per worker; those are built concurrently and stitched together.
+    if (options.max_leaf_size > std::numeric_limits<uint16_t>::max())
+        throw std::runtime_error("BVH leaves hold at most 65535 primitives; max_leaf_size is "
+                                 + std::to_string(options.max_leaf_size));
+
+    size_t threads = options.build_threads;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    nodes.reserve(2 * prims.size());
+
+    if (threads == 1 || prims.size() < options.parallel_min_size) {
+        build_linear_bvh(prims, 0, prims.size(), options, nodes, 0);
+        return;
+    }
+
+    parallel_bvh_plan plan;
+    plan_parallel_bvh(plan, prims, 0, prims.size(), prims.size() / (4 * threads) + 1, options, 0);
+    plan.subtrees.resize(plan.spans.size());
+
+    {
+        task_scheduler scheduler(threads);
+        scheduler.parallel_for(plan.spans.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const auto& span = plan.spans[i];
+                auto& subtree = plan.subtrees[i];
+                subtree.reserve(2 * (span.end - span.start));
+                build_linear_bvh(prims, span.start, span.end, options, subtree, span.depth);
+            }
+        });
+    }
+
+    size_t next = 0;
+    stitch_parallel_bvh(plan, next, nodes);
+}
+
+
+class linear_bvh : public hittable {
+  public:
+    linear_bvh(const hittable_list& list, const bvh_build_options& options = {}) {
+        auto prims = bvh_primitives(list.objects);
+        if (prims.empty())
+            return;
+
+        build_linear_bvh(prims, options, nodes);
+
+        primitives.reserve(prims.size());
+        for (const auto& p : prims)
+            primitives.push_back(list.objects[p.index]);
+        bbox = list.bounding_box();
+    }
+
+    linear_bvh(const bvh_node& root) {
+        flatten(root, 0);
+        bbox = root.bounding_box();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!intersect(r, ray_t, rec))
+            return false;
+        finalize_hit(r, rec);
+        return true;
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty())
+            return false;
+
+        // Per-ray setup shared by every slab test.
+        float orig[3], inv_dir[3];
+        int dir_is_neg[3];
+        for (int axis = 0; axis < 3; axis++) {
+            orig[axis] = float(r.origin()[axis]);
+            inv_dir[axis] = float(1.0 / r.direction()[axis]);
+            dir_is_neg[axis] = inv_dir[axis] < 0;
+        }
+
+        uint32_t stack[bvh_max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+        bool hit_anything = false;
+
+        while (true) {
+            const linear_bvh_node& node = nodes[current];
+#ifdef BVH_STATS
+            bvh_node_visits++;
+#endif
+            if (node_hit(node, orig, inv_dir, dir_is_neg, ray_t)) {
+                if (node.count > 0) {
+                    for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                        if (primitives[i]->intersect(r, ray_t, rec)) {
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    }
+                    if (stack_size == 0) break;
+                    current = stack[--stack_size];
+                } else if (dir_is_neg[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+            } else {
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+        }
+
+        return hit_anything;
+    }
+
+    void hit_packet(ray_packet& packet, uint32_t lanes, hit_record recs[]) const override {
+        // One traversal for the whole packet. Each stack entry carries the lanes that entered
+        // its parent; lanes that miss a node drop out below it. Children are ordered by the
+        // direction of the first lane, which for coherent packets suits them all.
+        if (nodes.empty() || !lanes)
+            return;
+
+        float orig[ray_packet::max_size][3], inv_dir[ray_packet::max_size][3];
+        int dir_is_neg[ray_packet::max_size][3];
+        for (int i = 0; i < packet.size; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                orig[i][axis] = float(packet.orig[axis][i]);
+                inv_dir[i][axis] = float(1.0 / packet.dir[axis][i]);
+                dir_is_neg[i][axis] = inv_dir[i][axis] < 0;
+            }
+        }
+        const int* order = dir_is_neg[__builtin_ctz(lanes)];
+
+        struct entry {
+            uint32_t node;
+            uint32_t lanes;
+        };
+
+        entry stack[bvh_max_depth];
+        int stack_size = 0;
+        entry current = { 0, lanes };
+
+        while (true) {
+            const linear_bvh_node& node = nodes[current.node];
+#ifdef BVH_STATS
+            bvh_node_visits++;
+#endif
+            uint32_t entering = 0;
+            for (uint32_t l = current.lanes; l; l &= l - 1) {
+                int i = __builtin_ctz(l);
+                if (node_hit(node, orig[i], inv_dir[i], dir_is_neg[i],
+                             interval(packet.t_min, packet.t_max[i])))
+                    entering |= 1u << i;
+            }
+
+            if (entering) {
+                if (node.count > 0) {
+                    for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+                        primitives[i]->hit_packet(packet, entering, recs);
+                } else if (order[node.axis]) {
+                    stack[stack_size++] = { current.node + 1, entering };
+                    current = { node.offset, entering };
+                    continue;
+                } else {
+                    stack[stack_size++] = { node.offset, entering };
+                    current = { current.node + 1, entering };
+                    continue;
+                }
+            }
+
+            if (stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        // Any hit ends the query, so children are visited in storage order and ray_t never
+        // shrinks.
+        if (nodes.empty())
+            return false;
+
+        float orig[3], inv_dir[3];
+        int dir_is_neg[3];
+        for (int axis = 0; axis < 3; axis++) {
+            orig[axis] = float(r.origin()[axis]);
+            inv_dir[axis] = float(1.0 / r.direction()[axis]);
+            dir_is_neg[axis] = inv_dir[axis] < 0;
+        }
+
+        uint32_t stack[bvh_max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        while (true) {
+            const linear_bvh_node& node = nodes[current];
+#ifdef BVH_STATS
+            bvh_node_visits++;
+#endif
+            if (node_hit(node, orig, inv_dir, dir_is_neg, ray_t)) {
+                if (node.count == 0) {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                    continue;
+                }
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                    if (primitives[i]->occluded(r, ray_t))
+                        return true;
+                }
+            }
+            if (stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+
+        return false;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+  private:
+    std::vector<linear_bvh_node> nodes;
+    std::vector<shared_ptr<hittable>> primitives;
+    aabb bbox;
+
+    static bool node_hit(const linear_bvh_node& node, const float orig[3], const float inv_dir[3],
+                         const int dir_is_neg[3], const interval& ray_t)
+    {
+        // Slab test against float bounds. The far distance is pushed out by a few ulps so
+        // rounding in the subtraction and product cannot reject a grazing ray.
+        const float far_scale = 1 + 2 * 3 * std::numeric_limits<float>::epsilon();
+
+        float t_min = float(ray_t.min);
+        float t_max = float(ray_t.max);
+        for (int axis = 0; axis < 3; axis++) {
+            float t0 = (node.bounds[dir_is_neg[axis]][axis] - orig[axis]) * inv_dir[axis];
+            float t1 = (node.bounds[1 - dir_is_neg[axis]][axis] - orig[axis]) * inv_dir[axis];
+            t1 *= far_scale;
+
+            if (t0 > t_min) t_min = t0;
+            if (t1 < t_max) t_max = t1;
+            if (t_min > t_max)
+                return false;
+        }
+        return true;
+    }
+
+    uint32_t flatten(const bvh_node& node, int depth) {
+        // Copies a bvh_node tree into the node array. Every child that is not itself a bvh_node
+        // becomes a single-primitive leaf, and so does a bvh_node below bvh_max_depth, e.g. one
+        // that was a primitive of the tree rather than part of it.
+        if (!node.right)
+            return add_leaf(node.left);
+
+        uint32_t index = uint32_t(nodes.size());
+        nodes.emplace_back();
+        set_node_bounds(nodes[index], node.bbox);
+
+        auto delta = node.right->bounding_box().centroid() - node.left->bounding_box().centroid();
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (std::fabs(delta[a]) > std::fabs(delta[axis])) axis = a;
+        nodes[index].axis = uint8_t(axis);
+
+        flatten_child(node.left, depth + 1);
+        nodes[index].offset = flatten_child(node.right, depth + 1);
+        return index;
+    }
+
+    uint32_t flatten_child(const shared_ptr<hittable>& child, int depth) {
+        auto node = dynamic_cast<const bvh_node*>(child.get());
+        if (node && depth < bvh_max_depth)
+            return flatten(*node, depth);
+        return add_leaf(child);
+    }
+
+    uint32_t add_leaf(const shared_ptr<hittable>& object) {
+        uint32_t index = uint32_t(nodes.size());
+        nodes.emplace_back();
+        set_node_bounds(nodes[index], object->bounding_box());
+        nodes[index].offset = uint32_t(primitives.size());
+        nodes[index].count = 1;
+        primitives.push_back(object);
+        return index;
+    }
+};
+
+#endif
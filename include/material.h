@@ -11,7 +11,7 @@
 class scatter_record {
   public:
     color attenuation;
-    shared_ptr<pdf> pdf_ptr;
+    material_pdf scatter_pdf;  // unused when skip_pdf is set
     bool skip_pdf;
     ray skip_pdf_ray;
 };
@@ -53,7 +53,7 @@ class lambertian : public material {
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+        srec.scatter_pdf = cosine_pdf(rec.normal);
         srec.skip_pdf = false;
         return true;
     }
@@ -80,7 +80,6 @@ class metal : public material {
         reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
 
         srec.attenuation = albedo;
-        srec.pdf_ptr = nullptr;
         srec.skip_pdf = true;
         srec.skip_pdf_ray = ray(rec.p, reflected, r_in.time());
 
@@ -101,7 +100,6 @@ class dielectric : public material {
 
         bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
             srec.attenuation = color(1.0, 1.0, 1.0);
-            srec.pdf_ptr = nullptr;
             srec.skip_pdf = true;
             double ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
 
@@ -160,7 +158,7 @@ class isotropic : public material {
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<sphere_pdf>();
+        srec.scatter_pdf = sphere_pdf();
         srec.skip_pdf = false;
         return true;
     }
@@ -176,9 +174,10 @@ class isotropic : public material {
 
 class mixture_pdf : public pdf {
   public:
-    mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1) {
-        p[0] = p0;
-        p[1] = p1;
+    // Refers to both pdfs, which must outlive the mixture.
+    mixture_pdf(const pdf& p0, const pdf& p1) {
+        p[0] = &p0;
+        p[1] = &p1;
     }
 
     double value(const vec3& direction) const override {
@@ -193,7 +192,7 @@ class mixture_pdf : public pdf {
     }
 
   private:
-    shared_ptr<pdf> p[2];
+    const pdf* p[2];
 };
 
 
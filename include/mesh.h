@@ -2,15 +2,25 @@
 #define MESH_H
 
 #include "hittable.h"
-#include "triangle.h"
+#include "wide_bvh.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <sstream>
 #include <vector>
 
+// A triangle mesh stored as data rather than as one hittable per face. Vertices are shared
+// in one buffer and faces are 32-bit index triples; for intersection, each triangle's first
+// vertex and two edges are precomputed into structure-of-arrays floats, ordered like the
+// leaves of the mesh's BVH so a leaf touches one contiguous run. The whole mesh shares one
+// material.
 class mesh : public hittable {
 public:
-    mesh(const std::string& filename, shared_ptr<material> mat) {
-        std::vector<point3> vertices;
+    mesh(const std::string& filename, shared_ptr<material> mat,
+         const bvh_build_options& options = {})
+      : mat(mat)
+    {
         std::ifstream file(filename);
         
         if (!file.is_open()) {
@@ -25,64 +35,259 @@ public:
             iss >> type;
 
             if (type == "v") {  // Vertex
-                double x, y, z;
+                float x, y, z;
                 iss >> x >> y >> z;
-                vertices.push_back(point3(x, y, z));
+                vertices.push_back({x, y, z});
             }
             else if (type == "f") {  // Face
-                std::string v1, v2, v3;
-                iss >> v1 >> v2 >> v3;
-                
                 // Extract vertex indices (handling both 'v' and 'v/vt/vn' formats)
-                int idx1 = std::stoi(v1.substr(0, v1.find("/"))) - 1;
-                int idx2 = std::stoi(v2.substr(0, v2.find("/"))) - 1;
-                int idx3 = std::stoi(v3.substr(0, v3.find("/"))) - 1;
-
-                if (idx1 >= 0 && idx2 >= 0 && idx3 >= 0 &&
-                    idx1 < vertices.size() && idx2 < vertices.size() && idx3 < vertices.size()) {
-                    triangles.push_back(make_shared<triangle>(
-                        vertices[idx1],
-                        vertices[idx2],
-                        vertices[idx3],
-                        mat
-                    ));
+                std::vector<int> face;
+                std::string corner;
+                while (iss >> corner)
+                    face.push_back(std::stoi(corner.substr(0, corner.find("/"))) - 1);
+
+                // Polygons are split into a fan around their first vertex.
+                for (size_t k = 2; k < face.size(); k++) {
+                    int idx1 = face[0], idx2 = face[k-1], idx3 = face[k];
+                    if (idx1 >= 0 && idx2 >= 0 && idx3 >= 0 &&
+                        idx1 < vertices.size() && idx2 < vertices.size() && idx3 < vertices.size()) {
+                        indices.push_back({ uint32_t(idx1), uint32_t(idx2), uint32_t(idx3) });
+                    }
                 }
             }
         }
 
-        set_bounding_box();
+        if (indices.empty())
+            return;
+
+        // Each mesh owns its bottom-level hierarchy, so the scene-level structure only ever
+        // sees one primitive per mesh.
+        auto start = std::chrono::steady_clock::now();
+        build(options);
+        auto stop = std::chrono::steady_clock::now();
+        build_seconds = std::chrono::duration<double>(stop - start).count();
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        hit_record temp_rec;
-        bool hit_anything = false;
-        auto closest_so_far = ray_t.max;
-
-        for (const auto& tri : triangles) {
-            if (tri->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
-                hit_anything = true;
-                closest_so_far = temp_rec.t;
-                rec = temp_rec;
+        if (!intersect(r, ray_t, rec))
+            return false;
+        finalize(r, rec);
+        return true;
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Only the index and barycentrics of the closest triangle are tracked during traversal.
+        return tree.closest_hit(r, ray_t, [&](uint32_t first, uint32_t count, interval& t) {
+            bool hit_anything = false;
+            for (uint32_t k = first; k < first + count; k++) {
+                double t_hit, u, v;
+                if (intersect(k, r, t, t_hit, u, v)) {
+                    hit_anything = true;
+                    t.max = t_hit;
+                    rec.t = t_hit;
+                    rec.u = u;
+                    rec.v = v;
+                    rec.prim_id = k;
+                }
             }
-        }
+            if (hit_anything) {
+                rec.object = this;
+                rec.instance = nullptr;
+            }
+            return hit_anything;
+        });
+    }
+
+    void finalize(const ray& r, hit_record& rec) const override {
+        set_hit_record(rec.prim_id, r, rec.t, rec.u, rec.v, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return tree.any_hit(r, ray_t, [&](uint32_t first, uint32_t count) {
+            for (uint32_t k = first; k < first + count; k++) {
+                double t_hit, u, v;
+                if (intersect(k, r, ray_t, t_hit, u, v))
+                    return true;
+            }
+            return false;
+        });
+    }
+
+    void hit_packet(ray_packet& packet, uint32_t lanes, hit_record recs[]) const override {
+        uint32_t closest[ray_packet::max_size];
+        double closest_u[ray_packet::max_size], closest_v[ray_packet::max_size];
+        uint32_t found = 0;
 
-        return hit_anything;
+        tree.packet_hit(packet, lanes, [&](uint32_t first, uint32_t count, uint32_t leaf_lanes) {
+            for (uint32_t k = first; k < first + count; k++) {
+                double ts[ray_packet::max_size], us[ray_packet::max_size], vs[ray_packet::max_size];
+                uint32_t hits = intersect_lanes(k, packet, ts, us, vs) & leaf_lanes;
+                for (; hits; hits &= hits - 1) {
+                    int i = __builtin_ctz(hits);
+                    packet.record_hit(i, ts[i]);
+                    closest[i] = k;
+                    closest_u[i] = us[i];
+                    closest_v[i] = vs[i];
+                    found |= 1u << i;
+                }
+            }
+        });
+
+        for (; found; found &= found - 1) {
+            int i = __builtin_ctz(found);
+            set_hit_record(closest[i], packet.rays[i], packet.t_max[i], closest_u[i], closest_v[i],
+                           recs[i]);
+        }
     }
 
     aabb bounding_box() const override { return bbox; }
 
+    size_t size() const { return indices.size(); }
+
+    // Seconds spent building the triangle BVH, excluding OBJ parsing.
+    double bvh_build_time() const { return build_seconds; }
+
+    // Bytes held by the vertex, index, intersection and hierarchy arrays.
+    size_t memory_bytes() const {
+        return vertices.size() * sizeof(vertices[0]) + indices.size() * sizeof(indices[0])
+             + indices.size() * 9 * sizeof(float) + tree.memory_bytes();
+    }
+
 private:
-    std::vector<shared_ptr<triangle>> triangles;
+    std::vector<std::array<float, 3>> vertices;
+    std::vector<std::array<uint32_t, 3>> indices;  // in BVH leaf order after build()
+
+    // Per triangle, in BVH leaf order: first vertex and the edges to the other two.
+    std::vector<float> v0[3], e1[3], e2[3];
+
+    shared_ptr<material> mat;
+    wide_bvh_tree<4> tree;
+    double build_seconds = 0;
     aabb bbox;
 
-    void set_bounding_box() {
-        if (triangles.empty()) return;
+    point3 vertex(uint32_t index) const {
+        const auto& v = vertices[index];
+        return point3(v[0], v[1], v[2]);
+    }
+
+    void build(const bvh_build_options& options) {
+        std::vector<bvh_primitive> prims(indices.size());
+        for (size_t k = 0; k < indices.size(); k++) {
+            auto a = vertex(indices[k][0]), b = vertex(indices[k][1]), c = vertex(indices[k][2]);
+            prims[k].box = aabb(aabb(a, b), aabb(c, c));
+            prims[k].centroid = prims[k].box.centroid();
+            prims[k].index = k;
+            bbox = aabb(bbox, prims[k].box);
+        }
+
+        tree.build(prims, options);
+
+        std::vector<std::array<uint32_t, 3>> ordered(indices.size());
+        for (int axis = 0; axis < 3; axis++) {
+            v0[axis].resize(indices.size());
+            e1[axis].resize(indices.size());
+            e2[axis].resize(indices.size());
+        }
+
+        for (size_t k = 0; k < prims.size(); k++) {
+            ordered[k] = indices[prims[k].index];
+            const auto& a = vertices[ordered[k][0]];
+            const auto& b = vertices[ordered[k][1]];
+            const auto& c = vertices[ordered[k][2]];
+            for (int axis = 0; axis < 3; axis++) {
+                v0[axis][k] = a[axis];
+                e1[axis][k] = b[axis] - a[axis];
+                e2[axis][k] = c[axis] - a[axis];
+            }
+        }
+        indices.swap(ordered);
+    }
+
+    bool intersect(uint32_t k, const ray& r, const interval& ray_t, double& t, double& u,
+                   double& v) const
+    {
+        // Möller–Trumbore against the precomputed edges, in double precision.
+        vec3 edge1(e1[0][k], e1[1][k], e1[2][k]);
+        vec3 edge2(e2[0][k], e2[1][k], e2[2][k]);
+        auto h = cross(r.direction(), edge2);
+        auto a = dot(edge1, h);
+
+        if (a > -1e-8 && a < 1e-8)
+            return false;
+
+        auto f = 1.0/a;
+        auto s = r.origin() - point3(v0[0][k], v0[1][k], v0[2][k]);
+        u = f * dot(s, h);
+
+        if (u < 0.0 || u > 1.0)
+            return false;
 
-        bbox = triangles[0]->bounding_box();
-        for (const auto& tri : triangles) {
-            bbox = aabb(bbox, tri->bounding_box());
+        auto q = cross(s, edge1);
+        v = f * dot(r.direction(), q);
+
+        if (v < 0.0 || u + v > 1.0)
+            return false;
+
+        t = f * dot(edge2, q);
+
+        return ray_t.contains(t);
+    }
+
+    uint32_t intersect_lanes(uint32_t k, const ray_packet& packet, double ts[], double us[],
+                             double vs[]) const
+    {
+        // The same test for every lane of a packet in one branch-free loop, which the compiler
+        // vectorizes. Returns the mask of lanes that hit within their current interval.
+        const double e1x = e1[0][k], e1y = e1[1][k], e1z = e1[2][k];
+        const double e2x = e2[0][k], e2y = e2[1][k], e2z = e2[2][k];
+        const double v0x = v0[0][k], v0y = v0[1][k], v0z = v0[2][k];
+        int hit[ray_packet::max_size];
+
+        for (int i = 0; i < packet.size; i++) {
+            double dx = packet.dir[0][i], dy = packet.dir[1][i], dz = packet.dir[2][i];
+            double sx = packet.orig[0][i] - v0x;
+            double sy = packet.orig[1][i] - v0y;
+            double sz = packet.orig[2][i] - v0z;
+
+            double hx = dy*e2z - dz*e2y;
+            double hy = dz*e2x - dx*e2z;
+            double hz = dx*e2y - dy*e2x;
+            double a = e1x*hx + e1y*hy + e1z*hz;
+            double f = 1.0/a;
+            double u = f * (sx*hx + sy*hy + sz*hz);
+
+            double qx = sy*e1z - sz*e1y;
+            double qy = sz*e1x - sx*e1z;
+            double qz = sx*e1y - sy*e1x;
+            double v = f * (dx*qx + dy*qy + dz*qz);
+            double t = f * (e2x*qx + e2y*qy + e2z*qz);
+
+            ts[i] = t;
+            us[i] = u;
+            vs[i] = v;
+            hit[i] = !(a > -1e-8 && a < 1e-8) && u >= 0.0 && u <= 1.0 && v >= 0.0
+                  && u + v <= 1.0 && packet.t_min <= t && t <= packet.t_max[i];
         }
+
+        uint32_t mask = 0;
+        for (int i = 0; i < packet.size; i++)
+            mask |= uint32_t(hit[i]) << i;
+        return mask;
+    }
+
+    void set_hit_record(uint32_t k, const ray& r, double t, double u, double v,
+                        hit_record& rec) const
+    {
+        vec3 edge1(e1[0][k], e1[1][k], e1[2][k]);
+        vec3 edge2(e2[0][k], e2[1][k], e2[2][k]);
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.mat = mat.get();
+        rec.set_face_normal(r, unit_vector(cross(edge1, edge2)));
+        rec.u = u;
+        rec.v = v;
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -4,6 +4,8 @@
 #include "onb.h"
 #include "hittable_list.h"
 
+#include <variant>
+
 
 class pdf {
   public:
@@ -62,4 +64,13 @@ class hittable_pdf : public pdf {
     point3 origin;
 };
 
+
+// The pdfs a material can scatter with, held by value in scatter_record so that a bounce
+// needs no heap allocation.
+using material_pdf = std::variant<sphere_pdf, cosine_pdf>;
+
+inline const pdf& as_pdf(const material_pdf& p) {
+    return std::visit([](const auto& alternative) -> const pdf& { return alternative; }, p);
+}
+
 #endif
\ No newline at end of file
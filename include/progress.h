@@ -0,0 +1,116 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+
+// Counters a render bumps as work finishes. Workers add whole tiles or lines at a time, so the
+// atomics see one update per unit of work, not per ray.
+struct render_progress {
+    std::atomic<long long> pixels{0};
+    std::atomic<long long> samples{0};
+    std::atomic<long long> rays{0};
+    long long pixels_total = 0;
+
+    void reset(long long total) {
+        pixels = 0;
+        samples = 0;
+        rays = 0;
+        pixels_total = total;
+    }
+
+    void add(long long pixel_count, long long sample_count, long long ray_count) {
+        pixels.fetch_add(pixel_count, std::memory_order_relaxed);
+        samples.fetch_add(sample_count, std::memory_order_relaxed);
+        rays.fetch_add(ray_count, std::memory_order_relaxed);
+    }
+};
+
+
+// One thread that samples a render_progress every `interval` seconds and reports it to
+// std::clog, so workers never touch the stream. "text" redraws a single status line; "json"
+// writes one JSON object per line for job monitors; "none" starts no thread. The final line,
+// with "done": true in JSON, is written when the reporter is destroyed.
+class progress_reporter {
+  public:
+    progress_reporter(const render_progress& progress, const std::string& mode, double interval)
+      : progress(progress), json(mode == "json"), start(clock::now())
+    {
+        if (mode != "text" && mode != "json" && mode != "none")
+            throw std::runtime_error("Unknown progress mode '" + mode + "'");
+        if (mode == "none")
+            return;
+
+        auto period = std::chrono::duration<double>(std::max(0.01, interval));
+        thread = std::thread([this, period] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stop_requested.wait_for(lock, period, [this] { return stop; }))
+                report(false);
+            report(true);
+        });
+    }
+
+    ~progress_reporter() {
+        if (!thread.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        stop_requested.notify_one();
+        thread.join();
+    }
+
+    progress_reporter(const progress_reporter&) = delete;
+    progress_reporter& operator=(const progress_reporter&) = delete;
+
+  private:
+    using clock = std::chrono::steady_clock;
+
+    const render_progress& progress;
+    bool json;
+    clock::time_point start;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable stop_requested;
+    bool stop = false;
+
+    void report(bool done) const {
+        double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        long long pixels = progress.pixels.load(std::memory_order_relaxed);
+        long long samples = progress.samples.load(std::memory_order_relaxed);
+        long long rays = progress.rays.load(std::memory_order_relaxed);
+        long long total = progress.pixels_total;
+
+        double fraction = total > 0 ? double(pixels) / total : 0;
+        double rays_per_second = elapsed > 0 ? rays / elapsed : 0;
+        // Remaining time at the average rate so far; -1 until there is a rate to go on.
+        double eta = pixels > 0 ? elapsed * (total - pixels) / pixels : -1;
+
+        if (json) {
+            std::clog << "{\"elapsed\": " << elapsed << ", \"pixels\": " << pixels
+                      << ", \"pixels_total\": " << total << ", \"samples\": " << samples
+                      << ", \"rays\": " << rays << ", \"rays_per_second\": " << rays_per_second
+                      << ", \"eta\": " << eta << ", \"done\": " << (done ? "true" : "false")
+                      << "}" << std::endl;
+            return;
+        }
+
+        std::clog << "\rProgress: " << int(100 * fraction) << "% | "
+                  << rays_per_second * 1e-6 << " Mrays/s | ";
+        if (eta >= 0)
+            std::clog << "ETA " << int(eta + 0.5) << " s    ";
+        std::clog << (done ? "\n" : "") << std::flush;
+    }
+};
+
+#endif
@@ -29,48 +29,87 @@ class quad : public hittable {
     aabb bounding_box() const override { return bbox; }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        auto denom = dot(normal, r.direction());
-
-        // No hit if the ray is parallel to the plane.
-        if (std::fabs(denom) < 1e-8)
+        if (!intersect(r, ray_t, rec))
             return false;
+        finalize(r, rec);
+        return true;
+    }
 
-        // Return false if the hit point parameter t is outside the ray interval.
-        auto t = (D - dot(normal, r.origin())) / denom;
-        if (!ray_t.contains(t))
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        double t, alpha, beta;
+        if (!plane_hit(r, ray_t, t, alpha, beta))
             return false;
 
-        // Determine if the hit point lies within the planar shape using its plane coordinates.
-        auto intersection = r.at(t);
-        vec3 planar_hitpt_vector = intersection - Q;
-        auto alpha = dot(w, cross(planar_hitpt_vector, v));
-        auto beta = dot(w, cross(u, planar_hitpt_vector));
-
         if (!is_interior(alpha, beta, rec))
             return false;
 
-        // Ray hits the 2D shape; set the rest of the hit record and return true.
         rec.t = t;
-        rec.p = intersection;
-        rec.mat = mat;
+        rec.object = this;
+        rec.instance = nullptr;
+        return true;
+    }
+
+    void finalize(const ray& r, hit_record& rec) const override {
+        // Ray hits the 2D shape; set the rest of the hit record.
+        rec.p = r.at(rec.t);
+        rec.mat = mat.get();
         rec.set_face_normal(r, normal);
+    }
 
-        return true;
+    void hit_packet(ray_packet& packet, uint32_t lanes, hit_record recs[]) const override {
+        // Plane distances and coordinates for every lane in one vectorizable loop, then the
+        // interior test and record for the lanes that reach the plane.
+        double ts[ray_packet::max_size], alphas[ray_packet::max_size], betas[ray_packet::max_size];
+        int found[ray_packet::max_size];
+
+        for (int i = 0; i < packet.size; i++) {
+            double ox = packet.orig[0][i], oy = packet.orig[1][i], oz = packet.orig[2][i];
+            double dx = packet.dir[0][i], dy = packet.dir[1][i], dz = packet.dir[2][i];
+
+            double denom = normal.x()*dx + normal.y()*dy + normal.z()*dz;
+            double t = (D - (normal.x()*ox + normal.y()*oy + normal.z()*oz)) / denom;
+
+            // Plane coordinates: alpha = w . (p x v), beta = w . (u x p), with p relative to Q.
+            double px = ox + t*dx - Q.x(), py = oy + t*dy - Q.y(), pz = oz + t*dz - Q.z();
+            alphas[i] = w.x()*(py*v.z() - pz*v.y()) + w.y()*(pz*v.x() - px*v.z())
+                      + w.z()*(px*v.y() - py*v.x());
+            betas[i] = w.x()*(u.y()*pz - u.z()*py) + w.y()*(u.z()*px - u.x()*pz)
+                     + w.z()*(u.x()*py - u.y()*px);
+            ts[i] = t;
+            found[i] = std::fabs(denom) >= 1e-8 && packet.t_min <= t && t <= packet.t_max[i];
+        }
+
+        for (; lanes; lanes &= lanes - 1) {
+            int i = __builtin_ctz(lanes);
+            if (!found[i] || !is_interior(alphas[i], betas[i], recs[i])) continue;
+            const ray& r = packet.rays[i];
+            recs[i].t = ts[i];
+            recs[i].p = r.at(ts[i]);
+            recs[i].mat = mat.get();
+            recs[i].set_face_normal(r, normal);
+            packet.record_hit(i, ts[i]);
+        }
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        double t;
+        return interior_hit(r, ray_t, t);
     }
 
     double pdf_value(const point3& origin, const vec3& direction) const override {
-        hit_record rec;
-        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+        double t;
+        if (!interior_hit(ray(origin, direction), interval(0.001, infinity), t))
             return 0;
 
-        auto distance_squared = rec.t * rec.t * direction.length_squared();
-        auto cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+        auto distance_squared = t * t * direction.length_squared();
+        auto cosine = std::fabs(dot(direction, normal) / direction.length());
 
         return distance_squared / (cosine * area);
     }
 
     vec3 random(const point3& origin) const override {
-        auto p = Q + (random_double() * u) + (random_double() * v);
+        auto [a, b] = random_double2();
+        auto p = Q + (a * u) + (b * v);
         return p - origin;
     }    
 
@@ -96,6 +135,33 @@ class quad : public hittable {
     vec3 normal;
     double D;
     double area;
+
+    bool plane_hit(const ray& r, const interval& ray_t, double& t, double& alpha, double& beta) const {
+        auto denom = dot(normal, r.direction());
+
+        // No hit if the ray is parallel to the plane.
+        if (std::fabs(denom) < 1e-8)
+            return false;
+
+        // Return false if the hit point parameter t is outside the ray interval.
+        t = (D - dot(normal, r.origin())) / denom;
+        if (!ray_t.contains(t))
+            return false;
+
+        // Plane coordinates of the hit point, for the interior test.
+        vec3 planar_hitpt_vector = r.at(t) - Q;
+        alpha = dot(w, cross(planar_hitpt_vector, v));
+        beta = dot(w, cross(u, planar_hitpt_vector));
+        return true;
+    }
+
+    bool interior_hit(const ray& r, const interval& ray_t, double& t) const {
+        // Visibility-only intersection. is_interior just records the uv coordinates, so a
+        // scratch record stands in for the caller's.
+        double alpha, beta;
+        hit_record uv;
+        return plane_hit(r, ray_t, t, alpha, beta) && is_interior(alpha, beta, uv);
+    }
 };
 
 
@@ -0,0 +1,44 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "ray.h"
+
+#include <cstdint>
+
+
+// Up to 16 rays traced together. Lane data is stored structure-of-arrays so primitive tests
+// can run one loop over all lanes; `rays` keeps the original rays for scalar fallbacks.
+// Lanes are addressed by bitmasks, bit i standing for lane i.
+struct ray_packet {
+    static constexpr int max_size = 16;
+
+    int      size = 0;
+    double   t_min = 0.001;
+    double   t_max[max_size];   // closest hit so far, shrinks as hits are found
+    uint32_t hits = 0;          // lanes whose hit_record holds a hit
+
+    ray      rays[max_size];
+    double   orig[3][max_size];
+    double   dir[3][max_size];
+    double   time[max_size];
+
+    void add(const ray& r, double max_t = infinity) {
+        int i = size++;
+        rays[i] = r;
+        t_max[i] = max_t;
+        for (int axis = 0; axis < 3; axis++) {
+            orig[axis][i] = r.origin()[axis];
+            dir[axis][i] = r.direction()[axis];
+        }
+        time[i] = r.time();
+    }
+
+    uint32_t all() const { return (1u << size) - 1; }
+
+    void record_hit(int i, double t) {
+        t_max[i] = t;
+        hits |= 1u << i;
+    }
+};
+
+#endif
@@ -2,11 +2,14 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <cstdio>
 #include <limits>
 #include <memory>
-#include <random>
+#include <utility>
+
+#include "sampler.h"
 
 
 // C++ Std Usings
@@ -25,11 +28,26 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
-thread_local std::mt19937 gen(std::random_device{}());
-thread_local std::uniform_real_distribution<double> dis(0.0, 1.0);
+// Random numbers come from the calling thread's sample_stream. The renderer starts it for each
+// camera sample from (sampler, pixel, sample, frame), so every value in a render is fixed by its
+// pixel, sample and dimension (draw index) and the image is the same whichever thread traces
+// what. Outside a camera sample, e.g. while a scene is built, each thread continues an
+// independent stream from a fixed start, so scene randomness is repeatable too.
+
+thread_local sample_stream random_stream;
+
+// For code that interleaves several sample streams on one thread, e.g. the lanes of a packet.
+inline sample_stream save_random() { return random_stream; }
+inline void restore_random(const sample_stream& stream) { random_stream = stream; }
 
 inline double random_double() {
-    return dis(gen);
+    // Returns a random real in [0,1).
+    return random_stream.next();
+}
+
+inline std::pair<double, double> random_double2() {
+    // Returns two random reals in [0,1) that sample a square together.
+    return random_stream.next_2d();
 }
 
 inline double random_double(double min, double max) {
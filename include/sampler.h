@@ -0,0 +1,265 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Where the random numbers of a camera sample come from:
+//
+//   independent  SplitMix64 values, unrelated from one draw to the next
+//   sobol        padded Owen-scrambled Sobol points: dimensions are consumed in pairs, and the
+//                pair at a given depth of the path is a stratified 2D point set over the
+//                samples of a pixel
+//   blue_noise   the same Sobol points shared by all pixels, each pixel's set shifted (mod 1)
+//                by a blue-noise mask, so the error left at low sample counts is spread as
+//                fine, even grain rather than clumps
+enum class sampler_type { independent, sobol, blue_noise };
+
+inline sampler_type sampler_type_from_name(const std::string& name) {
+    if (name == "independent") return sampler_type::independent;
+    if (name == "sobol")       return sampler_type::sobol;
+    if (name == "blue_noise")  return sampler_type::blue_noise;
+    throw std::runtime_error("Unknown sampler '" + name + "'");
+}
+
+
+inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Owen scrambling as a hash (Burley, "Practical Hash-based Owen Scrambling", 2020). The
+// Laine-Karras permutation flips each bit depending only on the bits below it, so on a
+// bit-reversed value it is a nested uniform scramble: every digit permuted depending on the
+// digits above it. Values are kept bit-reversed between scrambles to save the reversals.
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// Bit-reversed Sobol dimensions for an index. The first is van der Corput, whose reversal is
+// the index itself; the second is the Pascal-matrix dimension, which is linear in the bits of
+// the index and so is read from one table per index byte.
+struct sobol_table {
+    uint32_t bytes[4][256];
+};
+
+constexpr sobol_table make_reversed_sobol_1_table() {
+    sobol_table table{};
+    uint32_t direction[32] = {};
+    uint32_t v = 1;  // reversed 1 << 31
+    for (int bit = 0; bit < 32; bit++, v ^= v << 1)
+        direction[bit] = v;
+    for (int byte = 0; byte < 4; byte++)
+        for (int value = 0; value < 256; value++)
+            for (int bit = 0; bit < 8; bit++)
+                if (value >> bit & 1)
+                    table.bytes[byte][value] ^= direction[8 * byte + bit];
+    return table;
+}
+
+inline constexpr sobol_table reversed_sobol_1_lookup = make_reversed_sobol_1_table();
+
+inline uint32_t reversed_sobol_1(uint32_t index) {
+    const auto& t = reversed_sobol_1_lookup.bytes;
+    return t[0][index & 0xff] ^ t[1][index >> 8 & 0xff] ^ t[2][index >> 16 & 0xff]
+         ^ t[3][index >> 24];
+}
+
+
+// A 64x64 tileable blue-noise mask of ranks, by Ulichney's void-and-cluster method; value
+// (x, y) is in [0,1) and every value appears once. Built on first use, a few tens of
+// milliseconds.
+class blue_noise_mask {
+  public:
+    static constexpr int size = 64;
+
+    static const blue_noise_mask& get() {
+        static const blue_noise_mask mask;
+        return mask;
+    }
+
+    double at(int x, int y) const {
+        return values[size_t(y & (size - 1)) * size + (x & (size - 1))];
+    }
+
+  private:
+    static constexpr int count = size * size;
+    std::vector<float> values;
+
+    blue_noise_mask() : values(count) {
+        // Toroidal Gaussian, sigma 1.5, by offset.
+        std::vector<double> kernel(count);
+        for (int dy = 0; dy < size; dy++) {
+            for (int dx = 0; dx < size; dx++) {
+                int ex = std::min(dx, size - dx), ey = std::min(dy, size - dy);
+                kernel[dy * size + dx] = std::exp(-(ex * ex + ey * ey) / (2 * 1.5 * 1.5));
+            }
+        }
+
+        std::vector<char> on(count, 0);
+        std::vector<double> energy(count, 0.0);
+        auto toggle = [&](int p, bool set) {
+            on[p] = set;
+            int px = p % size, py = p / size;
+            double sign = set ? 1 : -1;
+            for (int q = 0; q < count; q++) {
+                int dx = (q % size - px) & (size - 1), dy = (q / size - py) & (size - 1);
+                energy[q] += sign * kernel[dy * size + dx];
+            }
+        };
+        auto extreme = [&](bool among_on) {
+            // Tightest cluster among set pixels, or largest void among clear ones.
+            int best = -1;
+            for (int p = 0; p < count; p++) {
+                if (bool(on[p]) != among_on)
+                    continue;
+                if (best < 0 || (among_on ? energy[p] > energy[best] : energy[p] < energy[best]))
+                    best = p;
+            }
+            return best;
+        };
+
+        // Initial pattern: a tenth of the pixels, then moved from clusters to voids until stable.
+        uint64_t state = 0x2545f4914f6cdd1dull;
+        int ones = 0;
+        while (ones < count / 10) {
+            int p = int(mix64(state += 0x9e3779b97f4a7c15ull) % count);
+            if (!on[p]) {
+                toggle(p, true);
+                ones++;
+            }
+        }
+        while (true) {
+            int cluster = extreme(true);
+            toggle(cluster, false);
+            int void_ = extreme(false);
+            toggle(void_, true);
+            if (void_ == cluster)
+                break;
+        }
+        const auto initial_on = on;
+        const auto initial_energy = energy;
+
+        // Ranks below the initial pattern: remove its tightest clusters one by one.
+        std::vector<int> rank(count);
+        for (int r = ones - 1; r >= 0; r--) {
+            int p = extreme(true);
+            toggle(p, false);
+            rank[p] = r;
+        }
+
+        // Ranks above it: fill the largest voids one by one until every pixel is set.
+        on = initial_on;
+        energy = initial_energy;
+        for (int r = ones; r < count; r++) {
+            int p = extreme(false);
+            toggle(p, true);
+            rank[p] = r;
+        }
+
+        for (int p = 0; p < count; p++)
+            values[p] = float((rank[p] + 0.5) / count);
+    }
+};
+
+
+// The random numbers of one camera sample, drawn one dimension at a time. start() fixes the
+// stream from the sampler type, the pixel, the sample index within the pixel and the frame, so
+// a draw depends only on those and on how many draws came before it.
+class sample_stream {
+  public:
+    constexpr sample_stream() = default;
+
+    void start(sampler_type sampler, int x, int y, uint64_t pixel, uint32_t sample,
+               uint64_t frame = 0) {
+        type = sampler;
+        px = x;
+        py = y;
+        reversed_index = reverse_bits(sample);
+        dimension = 0;
+        if (type == sampler_type::independent)
+            state = mix64(mix64(mix64(pixel) + sample) + frame);
+        else if (type == sampler_type::sobol)
+            state = mix64(mix64(pixel) + frame);
+        else
+            state = mix64(frame + 0x5851f42d4c957f2dull);  // one point set for every pixel
+    }
+
+    double next() {
+        if (type == sampler_type::independent)
+            return double(mix64(state += 0x9e3779b97f4a7c15ull) >> 11) * 0x1.0p-53;
+
+        double x = coordinate(dimension / 2, dimension & 1);
+        dimension++;
+        return x;
+    }
+
+    // Two values meant to be used together, e.g. a position on a square. They come from the
+    // same Sobol pair, so over the samples of a pixel they are stratified in 2D.
+    std::pair<double, double> next_2d() {
+        if (type == sampler_type::independent) {
+            double u = next();
+            return {u, next()};
+        }
+        dimension += dimension & 1;  // skip the unused half of a pair
+        uint32_t pair = dimension / 2;
+        dimension += 2;
+        return {coordinate(pair, 0), coordinate(pair, 1)};
+    }
+
+  private:
+    sampler_type type = sampler_type::independent;
+    uint64_t state = 0x853c49e6748fea9bull;  // SplitMix64 counter, or the Sobol scrambling key
+    int      px = 0, py = 0;
+    uint32_t reversed_index = 0;
+    uint32_t dimension = 0;
+
+    double coordinate(uint32_t pair, int axis) const {
+        // Each pair has its own scrambling, and its own shuffle of the sample order so that
+        // pairs are not correlated with each other. Only the requested half of the pair is
+        // computed; when both are, the shared part is computed once after inlining.
+        uint64_t key = (state ^ pair) * 0xd6e8feb86659fd93ull;
+        key ^= key >> 32;
+        uint64_t key2 = (key ^ key >> 29) * 0xbf58476d1ce4e5b9ull;
+        uint32_t i = reverse_bits(laine_karras_permutation(reversed_index, uint32_t(key)));
+
+        uint32_t bits = axis == 0 ? laine_karras_permutation(i, uint32_t(key >> 32))
+                                  : laine_karras_permutation(reversed_sobol_1(i),
+                                                             uint32_t(key2 >> 32));
+        double x = reverse_bits(bits) * 0x1.0p-32;
+
+        if (type == sampler_type::blue_noise) {
+            // Cranley-Patterson rotation by the mask, read at a different offset for every
+            // value so that the shifts of different dimensions are unrelated.
+            int ox = int(key2 >> 8 & 63), oy = int(key2 >> 14 & 63), oz = int(key2 >> 20 & 63);
+            x += axis == 0 ? blue_noise_mask::get().at(px + ox, py + oy)
+                           : blue_noise_mask::get().at(px + oz, py + ox + 17);
+            if (x >= 1)
+                x -= 1;
+        }
+        return x;
+    }
+};
+
+#endif
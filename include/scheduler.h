@@ -0,0 +1,304 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// A work-stealing thread pool for data-parallel loops.
+//
+// parallel_for(count, grain, body) hands [0, count) to the workers as one range. A worker runs
+// its range `grain` items at a time, and whenever its own deque is empty it first splits off
+// the upper half of what is left and pushes it, so an idle worker always has something to
+// steal. Ranges are only split when someone may take them, so a loop costs a handful of deque
+// operations rather than one task per item, and the body is called through a plain function
+// pointer, never a std::function.
+//
+// Each worker owns a Chase-Lev deque: the owner pushes and takes at the bottom without locks,
+// thieves take from the top with a compare-and-swap. Loops started from outside the pool go
+// through a small locked injection queue. Idle workers sleep on a condition variable; an epoch
+// counter makes sure a push that races with a worker going to sleep still wakes it.
+class task_scheduler {
+  public:
+    explicit task_scheduler(size_t num_threads = std::thread::hardware_concurrency())
+      : deques(std::max<size_t>(1, num_threads))
+    {
+        for (size_t i = 0; i < deques.size(); i++)
+            workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~task_scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    task_scheduler(const task_scheduler&) = delete;
+    task_scheduler& operator=(const task_scheduler&) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    // Calls body(begin, end) on disjoint chunks of at most `grain` items covering [0, count),
+    // and returns once all of them have finished. Chunks of the same loop run concurrently in
+    // any order, though each worker walks its part of the range front to back. May be called
+    // from inside a body; the calling worker then helps with the work until the loop is done.
+    template <typename Body>
+    void parallel_for(size_t count, size_t grain, const Body& body) {
+        if (count == 0)
+            return;
+
+        range_job job;
+        job.run = [](const void* b, size_t begin, size_t end) {
+            (*static_cast<const Body*>(b))(begin, end);
+        };
+        job.body = &body;
+        job.grain = std::max<size_t>(1, grain);
+        job.remaining.store(count, std::memory_order_relaxed);
+
+        if (current.owner == this) {
+            // Nested loop: start on it here, then help with whatever is queued until it is done.
+            execute(current.index, {&job, 0, count});
+            while (job.remaining.load(std::memory_order_acquire) > 0) {
+                task t;
+                if (find_task(current.index, t))
+                    execute(current.index, t);
+                else
+                    std::this_thread::yield();
+            }
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        injected.push_back({&job, 0, count});
+        injected_count.store(injected.size(), std::memory_order_release);
+        epoch++;
+        wake.notify_all();
+        finished.wait(lock, [&] { return job.remaining.load(std::memory_order_acquire) == 0; });
+    }
+
+    // Calls body(i) for every i in [0, count), handing out indices in increasing order to
+    // whichever worker is free next. Meant for work lists sorted by priority, where splitting the
+    // range would start cheap items at the back before expensive ones at the front.
+    template <typename Body>
+    void parallel_for_ordered(size_t count, const Body& body) {
+        std::atomic<size_t> next{0};
+        parallel_for(std::min(count, size()), 1, [&](size_t, size_t) {
+            for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count; )
+                body(i);
+        });
+    }
+
+  private:
+    struct range_job {
+        void (*run)(const void* body, size_t begin, size_t end);
+        const void* body;
+        size_t grain;
+        std::atomic<size_t> remaining;  // items not run yet
+    };
+
+    struct task {
+        range_job* job;
+        size_t begin, end;
+    };
+
+    // Fixed-capacity Chase-Lev deque (Le et al., "Correct and Efficient Work-Stealing for Weak
+    // Memory Models"). Workers only push while their deque is empty, so it never holds more
+    // than a few ranges; a full deque simply refuses the push. Slots are atomics so a thief's
+    // read of a slot being reused is a discarded stale value rather than a data race.
+    class work_deque {
+      public:
+        static constexpr size_t capacity = 64;
+
+        bool empty() const {
+            return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+        }
+
+        bool push(const task& t) {
+            auto b = bottom.load(std::memory_order_relaxed);
+            auto f = top.load(std::memory_order_acquire);
+            if (b - f >= std::ptrdiff_t(capacity))
+                return false;
+            store(b, t);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        bool take(task& t) {
+            auto b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto f = top.load(std::memory_order_relaxed);
+
+            if (f > b) {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+            t = load(b);
+            if (f == b) {
+                // Last item: race the thieves for it.
+                bool won = top.compare_exchange_strong(f, f + 1, std::memory_order_seq_cst,
+                                                       std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+
+        bool steal(task& t) {
+            auto f = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto b = bottom.load(std::memory_order_acquire);
+            if (f >= b)
+                return false;
+            t = load(f);
+            return top.compare_exchange_strong(f, f + 1, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed);
+        }
+
+      private:
+        struct slot {
+            std::atomic<range_job*> job;
+            std::atomic<size_t> begin, end;
+        };
+
+        alignas(64) std::atomic<std::ptrdiff_t> top{0};
+        alignas(64) std::atomic<std::ptrdiff_t> bottom{0};
+        slot slots[capacity];
+
+        void store(std::ptrdiff_t i, const task& t) {
+            auto& s = slots[size_t(i) % capacity];
+            s.job.store(t.job, std::memory_order_relaxed);
+            s.begin.store(t.begin, std::memory_order_relaxed);
+            s.end.store(t.end, std::memory_order_relaxed);
+        }
+
+        task load(std::ptrdiff_t i) const {
+            auto& s = slots[size_t(i) % capacity];
+            return {s.job.load(std::memory_order_relaxed), s.begin.load(std::memory_order_relaxed),
+                    s.end.load(std::memory_order_relaxed)};
+        }
+    };
+
+    struct worker_id {
+        const task_scheduler* owner;
+        size_t index;
+    };
+    static inline thread_local worker_id current;  // zero outside the workers
+
+    std::vector<work_deque>  deques;
+    std::vector<std::thread> workers;
+
+    std::mutex              mutex;          // guards injected, epoch and stop
+    std::condition_variable wake;           // workers wait here for work
+    std::condition_variable finished;       // outside callers wait here for their loop
+    std::vector<task>       injected;
+    std::atomic<size_t>     injected_count{0};
+    std::atomic<int>        sleeping{0};
+    unsigned long           epoch = 0;
+    bool                    stop = false;
+
+    void worker_loop(size_t index) {
+        current = {this, index};
+        task t;
+        while (true) {
+            if (find_task(index, t)) {
+                execute(index, t);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (stop)
+                return;
+            auto seen = epoch;
+            sleeping.fetch_add(1);
+            lock.unlock();
+
+            // Look once more after announcing the sleep: a push either sees `sleeping` and
+            // bumps the epoch, or happened early enough for this search to find it.
+            bool found = find_task(index, t);
+            lock.lock();
+            if (!found)
+                wake.wait(lock, [&] { return stop || epoch != seen; });
+            sleeping.fetch_sub(1);
+            lock.unlock();
+
+            if (found)
+                execute(index, t);
+        }
+    }
+
+    bool find_task(size_t index, task& t) {
+        if (deques[index].take(t))
+            return true;
+
+        if (injected_count.load(std::memory_order_acquire) > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!injected.empty()) {
+                t = injected.back();
+                injected.pop_back();
+                injected_count.store(injected.size(), std::memory_order_release);
+                return true;
+            }
+        }
+
+        for (size_t k = 1; k < deques.size(); k++) {
+            if (deques[(index + k) % deques.size()].steal(t))
+                return true;
+        }
+        return false;
+    }
+
+    void execute(size_t index, task t) {
+        auto& own = deques[index];
+        const size_t grain = t.job->grain;
+
+        while (t.begin < t.end) {
+            // Lazy splitting: offer the upper half only when there is nothing left to steal.
+            if (t.end - t.begin > grain && own.empty()) {
+                size_t mid = t.begin + (t.end - t.begin) / 2;
+                if (own.push({t.job, mid, t.end})) {
+                    t.end = mid;
+                    notify_push();
+                }
+            }
+
+            size_t end = std::min(t.end, t.begin + grain);
+            t.job->run(t.job->body, t.begin, end);
+            finish(*t.job, end - t.begin);
+            t.begin = end;
+        }
+    }
+
+    void notify_push() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_relaxed) == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            epoch++;
+        }
+        wake.notify_one();
+    }
+
+    void finish(range_job& job, size_t items) {
+        if (job.remaining.fetch_sub(items, std::memory_order_acq_rel) != items)
+            return;
+
+        // Last chunk of the loop. The job may be gone as soon as its caller sees the count,
+        // so only the scheduler's own members are touched from here on.
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.notify_all();
+    }
+};
+
+#endif
@@ -30,34 +30,67 @@ class sphere : public hittable {
 
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        point3 current_center = center.at(r.time());
-        vec3 oc = current_center - r.origin();
-        auto a = r.direction().length_squared();
-        auto h = dot(r.direction(), oc);
-        auto c = oc.length_squared() - radius*radius;
+        if (!intersect(r, ray_t, rec))
+            return false;
+        finalize(r, rec);
+        return true;
+    }
 
-        auto discriminant = h*h - a*c;
-        if (discriminant < 0)
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        double root;
+        if (!nearest_root(r, center.at(r.time()), ray_t, root))
             return false;
 
-        auto sqrtd = std::sqrt(discriminant);
+        rec.t = root;
+        rec.object = this;
+        rec.instance = nullptr;
+        return true;
+    }
 
-        // Find the nearest root that lies in the acceptable range.
-        auto root = (h - sqrtd) / a;
-        if (!ray_t.surrounds(root)) {
-            root = (h + sqrtd) / a;
-            if (!ray_t.surrounds(root))
-                return false;
+    void finalize(const ray& r, hit_record& rec) const override {
+        set_hit_record(r, center.at(r.time()), rec.t, rec);
+    }
+
+    void hit_packet(ray_packet& packet, uint32_t lanes, hit_record recs[]) const override {
+        // The root search runs over every lane without branches so it vectorizes; records are
+        // only filled in for the lanes that hit.
+        const auto& c0 = center.origin();
+        const auto& dc = center.direction();
+        double roots[ray_packet::max_size];
+        int found[ray_packet::max_size];
+
+        for (int i = 0; i < packet.size; i++) {
+            double ocx = c0.x() + packet.time[i]*dc.x() - packet.orig[0][i];
+            double ocy = c0.y() + packet.time[i]*dc.y() - packet.orig[1][i];
+            double ocz = c0.z() + packet.time[i]*dc.z() - packet.orig[2][i];
+            double dx = packet.dir[0][i], dy = packet.dir[1][i], dz = packet.dir[2][i];
+
+            double a = dx*dx + dy*dy + dz*dz;
+            double h = dx*ocx + dy*ocy + dz*ocz;
+            double c = ocx*ocx + ocy*ocy + ocz*ocz - radius*radius;
+            double discriminant = h*h - a*c;
+            double sqrtd = std::sqrt(std::fmax(discriminant, 0.0));
+
+            double near = (h - sqrtd) / a;
+            double far = (h + sqrtd) / a;
+            bool near_ok = packet.t_min < near && near < packet.t_max[i];
+            bool far_ok = packet.t_min < far && far < packet.t_max[i];
+            roots[i] = near_ok ? near : far;
+            found[i] = discriminant >= 0 && (near_ok || far_ok);
         }
 
-        rec.t = root;
-        rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p - current_center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat = mat;
+        for (; lanes; lanes &= lanes - 1) {
+            int i = __builtin_ctz(lanes);
+            if (!found[i]) continue;
+            const ray& r = packet.rays[i];
+            set_hit_record(r, center.at(r.time()), roots[i], recs[i]);
+            packet.record_hit(i, roots[i]);
+        }
+    }
 
-        return true;
+    bool occluded(const ray& r, interval ray_t) const override {
+        double root;
+        return nearest_root(r, center.at(r.time()), ray_t, root);
     }
 
     aabb bounding_box() const override { return bbox; }
@@ -66,8 +99,7 @@ class sphere : public hittable {
     double pdf_value(const point3& origin, const vec3& direction) const override {
         // This method only works for stationary spheres.
 
-        hit_record rec;
-        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+        if (!occluded(ray(origin, direction), interval(0.001, infinity)))
             return 0;
 
         auto dist_squared = (center.at(0) - origin).length_squared();
@@ -93,9 +125,43 @@ class sphere : public hittable {
     aabb bbox;
 
 
+    void set_hit_record(const ray& r, const point3& current_center, double root,
+                        hit_record& rec) const
+    {
+        rec.t = root;
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - current_center) / radius;
+        rec.set_face_normal(r, outward_normal);
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.mat = mat.get();
+    }
+
+    bool nearest_root(const ray& r, const point3& current_center, const interval& ray_t,
+                      double& root) const
+    {
+        vec3 oc = current_center - r.origin();
+        auto a = r.direction().length_squared();
+        auto h = dot(r.direction(), oc);
+        auto c = oc.length_squared() - radius*radius;
+
+        auto discriminant = h*h - a*c;
+        if (discriminant < 0)
+            return false;
+
+        auto sqrtd = std::sqrt(discriminant);
+
+        // Find the nearest root that lies in the acceptable range.
+        root = (h - sqrtd) / a;
+        if (!ray_t.surrounds(root)) {
+            root = (h + sqrtd) / a;
+            if (!ray_t.surrounds(root))
+                return false;
+        }
+        return true;
+    }
+
     static vec3 random_to_sphere(double radius, double distance_squared) {
-      auto r1 = random_double();
-      auto r2 = random_double();
+      auto [r1, r2] = random_double2();
       auto z = 1 + r2*(std::sqrt(1-radius*radius/distance_squared) - 1);
 
       auto phi = 2*pi*r1;
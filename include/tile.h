@@ -0,0 +1,80 @@
+#ifndef TILE_H
+#define TILE_H
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+struct pixel_coord {
+    int i, j;
+};
+
+// A rectangle of pixels [x0, x1) x [y0, y1) rendered as one unit of work.
+struct tile {
+    int x0, y0, x1, y1;
+    double cost = 0;  // estimated render time, used to start the expensive tiles first
+    long   rays = 0;  // rays traced while estimating the cost
+};
+
+
+inline std::pair<int, int> morton_point(int d) {
+    // Even bits of d give x, odd bits give y.
+    int x = 0, y = 0;
+    for (int bit = 0; bit < 16; bit++) {
+        x |= (d >> (2 * bit) & 1) << bit;
+        y |= (d >> (2 * bit + 1) & 1) << bit;
+    }
+    return {x, y};
+}
+
+inline std::pair<int, int> hilbert_point(int n, int d) {
+    // Position of step d along the Hilbert curve filling an n x n square, n a power of two.
+    int x = 0, y = 0;
+    for (int s = 1; s < n; s *= 2) {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+    return {x, y};
+}
+
+// Pixel offsets within a size x size tile, in the order they are rendered: "hilbert",
+// "morton" or "scanline". The curves keep consecutive pixels next to each other, so their
+// rays tend to visit the same BVH nodes while they are still in cache.
+inline std::vector<std::pair<int, int>> tile_pixel_order(int size, const std::string& order) {
+    std::vector<std::pair<int, int>> pixels;
+    pixels.reserve(size_t(size) * size);
+
+    if (order == "scanline") {
+        for (int y = 0; y < size; y++)
+            for (int x = 0; x < size; x++)
+                pixels.emplace_back(x, y);
+        return pixels;
+    }
+    if (order != "hilbert" && order != "morton")
+        throw std::runtime_error("Unknown pixel order '" + order + "'");
+
+    // Walk the curve over the enclosing power-of-two square and keep the points in the tile.
+    int n = 1;
+    while (n < size)
+        n *= 2;
+    for (int d = 0; d < n * n; d++) {
+        auto p = order == "hilbert" ? hilbert_point(n, d) : morton_point(d);
+        if (p.first < size && p.second < size)
+            pixels.push_back(p);
+    }
+    return pixels;
+}
+
+#endif
@@ -34,6 +34,90 @@ class triangle : public hittable {
     aabb bounding_box() const override { return bbox; }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!intersect(r, ray_t, rec))
+            return false;
+        finalize(r, rec);
+        return true;
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        double t, u, v;
+        if (!intersect(r, ray_t, t, u, v))
+            return false;
+
+        rec.t = t;
+        rec.u = u;
+        rec.v = v;
+        rec.object = this;
+        rec.instance = nullptr;
+        return true;
+    }
+
+    void finalize(const ray& r, hit_record& rec) const override {
+        rec.p = r.at(rec.t);
+        rec.mat = mat.get();
+        rec.set_face_normal(r, normal);
+    }
+
+    void hit_packet(ray_packet& packet, uint32_t lanes, hit_record recs[]) const override {
+        // Möller–Trumbore over every lane in one vectorizable loop.
+        auto edge1 = v1 - v0;
+        auto edge2 = v2 - v0;
+        double ts[ray_packet::max_size], us[ray_packet::max_size], vs[ray_packet::max_size];
+        int found[ray_packet::max_size];
+
+        for (int i = 0; i < packet.size; i++) {
+            double dx = packet.dir[0][i], dy = packet.dir[1][i], dz = packet.dir[2][i];
+            double sx = packet.orig[0][i] - v0.x();
+            double sy = packet.orig[1][i] - v0.y();
+            double sz = packet.orig[2][i] - v0.z();
+
+            double hx = dy*edge2.z() - dz*edge2.y();
+            double hy = dz*edge2.x() - dx*edge2.z();
+            double hz = dx*edge2.y() - dy*edge2.x();
+            double a = edge1.x()*hx + edge1.y()*hy + edge1.z()*hz;
+            double f = 1.0/a;
+            double u = f * (sx*hx + sy*hy + sz*hz);
+
+            double qx = sy*edge1.z() - sz*edge1.y();
+            double qy = sz*edge1.x() - sx*edge1.z();
+            double qz = sx*edge1.y() - sy*edge1.x();
+            double v = f * (dx*qx + dy*qy + dz*qz);
+            double t = f * (edge2.x()*qx + edge2.y()*qy + edge2.z()*qz);
+
+            ts[i] = t;
+            us[i] = u;
+            vs[i] = v;
+            found[i] = !(a > -1e-8 && a < 1e-8) && u >= 0.0 && u <= 1.0 && v >= 0.0
+                    && u + v <= 1.0 && packet.t_min <= t && t <= packet.t_max[i];
+        }
+
+        for (; lanes; lanes &= lanes - 1) {
+            int i = __builtin_ctz(lanes);
+            if (!found[i]) continue;
+            const ray& r = packet.rays[i];
+            recs[i].t = ts[i];
+            recs[i].p = r.at(ts[i]);
+            recs[i].mat = mat.get();
+            recs[i].set_face_normal(r, normal);
+            recs[i].u = us[i];
+            recs[i].v = vs[i];
+            packet.record_hit(i, ts[i]);
+        }
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        double t, u, v;
+        return intersect(r, ray_t, t, u, v);
+    }
+
+  private:
+    point3 v0, v1, v2;  // Vertices
+    vec3 normal;        // Triangle normal
+    shared_ptr<material> mat;
+    aabb bbox;
+
+    bool intersect(const ray& r, const interval& ray_t, double& t, double& u, double& v) const {
         // Möller–Trumbore intersection algorithm
         auto edge1 = v1 - v0;
         auto edge2 = v2 - v0;
@@ -45,37 +129,21 @@ class triangle : public hittable {
 
         auto f = 1.0/a;
         auto s = r.origin() - v0;
-        auto u = f * dot(s, h);
+        u = f * dot(s, h);
 
         if (u < 0.0 || u > 1.0)
             return false;
 
         auto q = cross(s, edge1);
-        auto v = f * dot(r.direction(), q);
+        v = f * dot(r.direction(), q);
 
         if (v < 0.0 || u + v > 1.0)
             return false;
 
-        auto t = f * dot(edge2, q);
-
-        if (!ray_t.contains(t))
-            return false;
-
-        rec.t = t;
-        rec.p = r.at(t);
-        rec.mat = mat;
-        rec.set_face_normal(r, normal);
-        rec.u = u;
-        rec.v = v;
+        t = f * dot(edge2, q);
 
-        return true;
+        return ray_t.contains(t);
     }
-
-  private:
-    point3 v0, v1, v2;  // Vertices
-    vec3 normal;        // Triangle normal
-    shared_ptr<material> mat;
-    aabb bbox;
 };
 
 #endif 
\ No newline at end of file
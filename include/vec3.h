@@ -116,36 +116,43 @@ inline vec3 unit_vector(const vec3& v) {
     return v / v.length();
 }
 
+// The samplers below map one 2D random point each, with no rejection, so a stratified point set
+// stays stratified on the sphere, disk or hemisphere.
+
 inline vec3 random_unit_vector() {
-    while(true) {
-        auto p = vec3::random(-1,1);
-        auto lensq = p.length_squared();
-        if(1e-160 < lensq && lensq <= 1)
-        {
-            return p / sqrt(lensq);
-        }
-    }
+    auto [r1, r2] = random_double2();
+    auto z = 1 - 2*r1;
+    auto r = std::sqrt(std::fmax(0.0, 1 - z*z));
+    auto phi = 2*pi*r2;
+    return vec3(r * std::cos(phi), r * std::sin(phi), z);
 }
 
 inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1),0);
-        if (p.length_squared() < 1)
-            return p;
+    // Shirley-Chiu concentric map of the square onto the disk.
+    auto [r1, r2] = random_double2();
+    auto a = 2*r1 - 1;
+    auto b = 2*r2 - 1;
+    if (a == 0 && b == 0)
+        return vec3(0,0,0);
+
+    double r, phi;
+    if (a*a > b*b) {
+        r = a;
+        phi = (pi/4) * (b/a);
+    } else {
+        r = b;
+        phi = pi/2 - (pi/4) * (a/b);
     }
+    return vec3(r * std::cos(phi), r * std::sin(phi), 0);
 }
 
 inline vec3 random_in_unit_sphere() {
-    while (true) {
-        auto p = vec3::random(-1,1);
-        if (p.length_squared() < 1)
-            return p;
-    }
+    auto radius = std::cbrt(random_double());
+    return radius * random_unit_vector();
 }
 
 inline vec3 random_cosine_direction() {
-    auto r1 = random_double();
-    auto r2 = random_double();
+    auto [r1, r2] = random_double2();
 
     auto phi = 2*pi*r1;
     auto x = std::cos(phi) * std::sqrt(r2);
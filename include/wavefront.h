@@ -0,0 +1,293 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "camera.h"
+#include "hittable.h"
+#include "material.h"
+#include "scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+// A breadth-first path tracer producing the same estimate as camera::ray_color. Rather than
+// following one path to the end, it keeps a wave of paths in flight and runs each stage over
+// all of them before starting the next:
+//
+//   generate    camera rays for every sample of a block of pixels
+//   extend      closest hit for every live path
+//   shade       emission, material scatter and direction sampling
+//   light       light-pdf evaluation of the sampled directions (the light-visibility tests)
+//   accumulate  per-pixel averages once the wave has finished
+//
+// Each stage is a tight loop over one kind of work, split across a task_scheduler. Path state
+// lives in one array per field, indexed by path. With sort_rays, live paths are bucketed by
+// direction before extend and by material before shade.
+class wavefront_renderer {
+  public:
+    size_t wave_size = 1 << 18;  // paths in flight at once, rounded to whole pixels
+    // Reorder paths by direction before extend and by material before shade. Off by default:
+    // on the scenes at hand the reordering costs more in scattered path-state access than it
+    // saves in coherence.
+    bool   sort_rays = false;
+
+    wavefront_renderer(camera& cam) : cam(cam) {}
+
+    void render(const hittable& world, int num_threads, const hittable& lights) {
+        // Waves cover blocks of pixels in scanline order, but the image is only written whole,
+        // and every pixel gets samples_per_pixel samples in one go.
+        if (cam.stream_band_rows > 0)
+            throw std::runtime_error("The wavefront renderer cannot stream the image in bands");
+        if (cam.adaptive_threshold > 0)
+            throw std::runtime_error("The wavefront renderer cannot sample adaptively");
+        if (cam.time_budget > 0 || !cam.checkpoint_path.empty())
+            throw std::runtime_error("The wavefront renderer cannot render progressively");
+        cam.initialize();
+
+        const int width = cam.image_width;
+        const int height = cam.image_height;
+        const size_t spp = size_t(cam.samples_per_pixel);
+        const size_t pixels_per_wave = std::max<size_t>(1, wave_size / spp);
+
+        framebuffer& image = cam.image;
+        image.resize(width, height);
+        task_scheduler scheduler(std::max(1, num_threads));
+        cam.progress.reset((long long)image.size());
+        {
+            progress_reporter reporter(cam.progress, cam.progress_mode, cam.progress_interval);
+
+            for (size_t first = 0; first < image.size(); first += pixels_per_wave) {
+                size_t pixel_count = std::min(pixels_per_wave, image.size() - first);
+                trace_wave(world, lights, scheduler, first, pixel_count, spp);
+
+                timed(accumulate_time, [&] {
+                    scheduler.parallel_for(pixel_count, grain, [&](size_t begin, size_t end) {
+                        for (size_t k = begin; k < end; k++) {
+                            color sum(0,0,0);
+                            for (size_t s = 0; s < spp; s++)
+                                sum += radiance[k * spp + s];
+                            image.set(first + k, sum / double(spp));
+                        }
+                    });
+                });
+
+                cam.progress.add(pixel_count, pixel_count * spp, 0);
+            }
+        }
+
+        write_image(image, cam.output_path, cam.output_format, num_threads);
+
+        std::clog << "Done!\n"
+                  << "Wavefront stages (s): generate " << generate_time
+                  << ", extend " << extend_time << ", shade " << shade_time
+                  << ", light " << light_time << ", accumulate " << accumulate_time
+                  << ", sort/compact " << queue_time << "\n";
+    }
+
+  private:
+    enum path_state : uint8_t { done, extend, sample_light };
+
+    camera& cam;
+    static constexpr size_t grain = 256;  // paths per parallel_for chunk
+
+    // Per-path state for the current wave.
+    std::vector<ray>        rays;
+    std::vector<color>      throughput;
+    std::vector<color>      radiance;
+    std::vector<hit_record> records;
+    std::vector<uint8_t>    found;       // records[p] holds a hit
+    std::vector<uint8_t>    state;
+    std::vector<color>      weight;      // attenuation * scattering pdf of the sampled bounce
+    std::vector<double>     brdf_pdf;    // material pdf of the sampled direction
+    std::vector<sample_stream> random;   // the path's random stream from its camera sample
+
+    std::vector<uint32_t>   active;      // live paths, in processing order
+    std::vector<uint32_t>   sorted;
+    std::vector<uint32_t>   bucket_start;
+
+    double generate_time = 0, extend_time = 0, shade_time = 0, light_time = 0,
+           accumulate_time = 0, queue_time = 0;
+
+    template <typename F>
+    static void timed(double& total, F&& stage) {
+        auto start = std::chrono::steady_clock::now();
+        stage();
+        total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void trace_wave(const hittable& world, const hittable& lights, task_scheduler& scheduler,
+                    size_t first_pixel, size_t pixel_count, size_t spp) {
+        const size_t paths = pixel_count * spp;
+        rays.resize(paths);
+        throughput.resize(paths);
+        radiance.resize(paths);
+        records.resize(paths);
+        found.resize(paths);
+        state.resize(paths);
+        weight.resize(paths);
+        brdf_pdf.resize(paths);
+        random.resize(paths);
+
+        timed(generate_time, [&] {
+            scheduler.parallel_for(paths, grain, [&](size_t begin, size_t end) {
+                for (size_t p = begin; p < end; p++) {
+                    size_t pixel = first_pixel + p / spp;
+                    int sample = int(p % spp);
+                    int i = int(pixel % cam.image_width);
+                    int j = int(pixel / cam.image_width);
+                    cam.seed_sample(i, j, sample);
+                    rays[p] = cam.get_ray(i, j, sample);
+                    random[p] = save_random();
+                    throughput[p] = color(1,1,1);
+                    radiance[p] = color(0,0,0);
+                    state[p] = extend;
+                }
+            });
+
+            active.resize(paths);
+            for (size_t p = 0; p < paths; p++)
+                active[p] = uint32_t(p);
+        });
+
+        for (int depth = 0; depth < cam.max_depth && !active.empty(); depth++) {
+            // Camera rays are already coherent in pixel order; after a bounce they are not.
+            if (sort_rays && depth > 0)
+                timed(queue_time, [&] { sort_active(1 << 11, [this](uint32_t p) { return direction_key(p); }); });
+
+            timed(extend_time, [&] {
+                scheduler.parallel_for(active.size(), grain, [&](size_t begin, size_t end) {
+                    for (size_t k = begin; k < end; k++) {
+                        auto p = active[k];
+                        restore_random(random[p]);
+                        found[p] = world.hit(rays[p], interval(0.001, infinity), records[p]);
+                        random[p] = save_random();
+                    }
+                });
+            });
+
+            cam.progress.add(0, 0, (long long)active.size());
+
+            if (sort_rays)
+                timed(queue_time, [&] { sort_active(1 << 10, [this](uint32_t p) { return material_key(p); }); });
+
+            timed(shade_time, [&] {
+                scheduler.parallel_for(active.size(), grain, [&](size_t begin, size_t end) {
+                    for (size_t k = begin; k < end; k++) {
+                        auto p = active[k];
+                        restore_random(random[p]);
+                        shade(p, lights);
+                        random[p] = save_random();
+                    }
+                });
+            });
+
+            timed(light_time, [&] {
+                scheduler.parallel_for(active.size(), grain, [&](size_t begin, size_t end) {
+                    for (size_t k = begin; k < end; k++) {
+                        auto p = active[k];
+                        if (state[p] == sample_light)
+                            weigh_light_sample(p, lights);
+                    }
+                });
+            });
+
+            timed(queue_time, [&] {
+                active.erase(std::remove_if(active.begin(), active.end(),
+                                            [this](uint32_t p) { return state[p] == done; }),
+                             active.end());
+            });
+        }
+    }
+
+    void shade(uint32_t p, const hittable& lights) {
+        // One bounce of camera::path_color, up to the point where the light pdf is needed.
+        const hit_record& rec = records[p];
+        if (!found[p]) {
+            radiance[p] += throughput[p] * cam.background;
+            state[p] = done;
+            return;
+        }
+
+        radiance[p] += throughput[p] * rec.mat->emitted(rays[p], rec, rec.u, rec.v, rec.p);
+
+        scatter_record srec;
+        if (!rec.mat->scatter(rays[p], rec, srec)) {
+            state[p] = done;
+            return;
+        }
+
+        if (srec.skip_pdf) {
+            rays[p] = srec.skip_pdf_ray;
+            throughput[p] = throughput[p] * srec.attenuation;
+            state[p] = extend;
+            return;
+        }
+
+        // Same choice as mixture_pdf(light, material).generate().
+        const pdf& scatter_pdf = as_pdf(srec.scatter_pdf);
+        vec3 direction = random_double() < 0.5 ? lights.random(rec.p) : scatter_pdf.generate();
+        ray scattered(rec.p, direction, rays[p].time());
+
+        double scattering_pdf = rec.mat->scattering_pdf(rays[p], rec, scattered);
+        if (scattering_pdf < 0.00001) {
+            state[p] = done;
+            return;
+        }
+
+        brdf_pdf[p] = scatter_pdf.value(direction);
+        weight[p] = srec.attenuation * scattering_pdf;
+        rays[p] = scattered;
+        state[p] = sample_light;
+    }
+
+    void weigh_light_sample(uint32_t p, const hittable& lights) {
+        const ray& r = rays[p];
+        double pdf_value = 0.5 * lights.pdf_value(r.origin(), r.direction()) + 0.5 * brdf_pdf[p];
+        if (pdf_value < 0.00001) {
+            state[p] = done;
+            return;
+        }
+
+        throughput[p] = throughput[p] * weight[p] / pdf_value;
+        state[p] = extend;
+    }
+
+    uint32_t direction_key(uint32_t p) const {
+        // Octant, then a coarse 16x16 cell of the direction within it: 2048 buckets.
+        auto d = unit_vector(rays[p].direction());
+        uint32_t octant = (d.x() < 0) | (d.y() < 0) << 1 | (d.z() < 0) << 2;
+        uint32_t cx = uint32_t(std::fabs(d.x()) * 15.99);
+        uint32_t cy = uint32_t(std::fabs(d.y()) * 15.99);
+        return octant << 8 | cx << 4 | cy;
+    }
+
+    uint32_t material_key(uint32_t p) const {
+        // Misses first, then one of 1023 buckets hashed from the material's address, so paths
+        // on the same material end up next to each other.
+        if (!found[p])
+            return 0;
+        auto address = uint64_t(reinterpret_cast<uintptr_t>(records[p].mat));
+        return 1 + uint32_t((address >> 4) * 0x9E3779B97F4A7C15ull >> 54) % 1023;
+    }
+
+    template <typename Key>
+    void sort_active(uint32_t buckets, Key key) {
+        // Stable counting sort into `buckets` keys; paths keep their relative order in a bucket.
+        bucket_start.assign(buckets + 1, 0);
+        for (auto p : active)
+            bucket_start[key(p) + 1]++;
+        for (uint32_t b = 0; b < buckets; b++)
+            bucket_start[b + 1] += bucket_start[b];
+
+        sorted.resize(active.size());
+        for (auto p : active)
+            sorted[bucket_start[key(p)]++] = p;
+        active.swap(sorted);
+    }
+};
+
+#endif
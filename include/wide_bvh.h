@@ -0,0 +1,443 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+
+// A node with up to N children whose bounds are stored structure-of-arrays, so one slab test
+// covers all of them. Child i is an inner node when count[i] == 0, otherwise a leaf holding
+// count[i] primitives starting at child[i]. Unused slots have inverted (empty) bounds.
+template <int N>
+struct alignas(N * 4) wide_bvh_node {
+    float    bounds[2][3][N];  // [min/max][axis][child]
+    uint32_t child[N];
+    uint16_t count[N];
+};
+
+
+// Ray data that every slab test needs, computed once per ray.
+struct wide_ray {
+    float orig[3];
+    float inv_dir[3];
+    int   dir_is_neg[3];
+
+    wide_ray() {}
+
+    wide_ray(const ray& r) {
+        for (int axis = 0; axis < 3; axis++) {
+            orig[axis] = float(r.origin()[axis]);
+            inv_dir[axis] = float(1.0 / r.direction()[axis]);
+            dir_is_neg[axis] = inv_dir[axis] < 0;
+        }
+    }
+};
+
+// Far distances are pushed out by a few ulps so float rounding cannot reject a grazing ray.
+constexpr float wide_far_scale = 1 + 2 * 3 * std::numeric_limits<float>::epsilon();
+
+
+template <int N>
+inline unsigned wide_slab_test(const wide_bvh_node<N>& node, const wide_ray& wr, float t_min,
+                               float t_max, float t_near[N])
+{
+    // Returns a bitmask of the children whose bounds the ray enters within [t_min, t_max], and
+    // their entry distances.
+    unsigned mask = 0;
+    for (int i = 0; i < N; i++) {
+        float lo = t_min;
+        float hi = t_max;
+        for (int axis = 0; axis < 3; axis++) {
+            float t0 = (node.bounds[wr.dir_is_neg[axis]][axis][i] - wr.orig[axis]) * wr.inv_dir[axis];
+            float t1 = (node.bounds[1 - wr.dir_is_neg[axis]][axis][i] - wr.orig[axis]) * wr.inv_dir[axis];
+            t1 *= wide_far_scale;
+            if (t0 > lo) lo = t0;
+            if (t1 < hi) hi = t1;
+        }
+        t_near[i] = lo;
+        mask |= unsigned(lo <= hi) << i;
+    }
+    return mask;
+}
+
+#if defined(__SSE2__)
+template <>
+inline unsigned wide_slab_test<4>(const wide_bvh_node<4>& node, const wide_ray& wr, float t_min,
+                                  float t_max, float t_near[4])
+{
+    __m128 lo = _mm_set1_ps(t_min);
+    __m128 hi = _mm_set1_ps(t_max);
+    for (int axis = 0; axis < 3; axis++) {
+        __m128 o = _mm_set1_ps(wr.orig[axis]);
+        __m128 inv = _mm_set1_ps(wr.inv_dir[axis]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[wr.dir_is_neg[axis]][axis]), o), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[1 - wr.dir_is_neg[axis]][axis]), o), inv);
+        t1 = _mm_mul_ps(t1, _mm_set1_ps(wide_far_scale));
+        // Operand order matters: min/max return the second operand when either is NaN, which
+        // keeps the running interval when 0 * inf shows up on an axis-parallel ray.
+        lo = _mm_max_ps(t0, lo);
+        hi = _mm_min_ps(t1, hi);
+    }
+    _mm_storeu_ps(t_near, lo);
+    return unsigned(_mm_movemask_ps(_mm_cmple_ps(lo, hi)));
+}
+#endif
+
+#if defined(__AVX__)
+template <>
+inline unsigned wide_slab_test<8>(const wide_bvh_node<8>& node, const wide_ray& wr, float t_min,
+                                  float t_max, float t_near[8])
+{
+    __m256 lo = _mm256_set1_ps(t_min);
+    __m256 hi = _mm256_set1_ps(t_max);
+    for (int axis = 0; axis < 3; axis++) {
+        __m256 o = _mm256_set1_ps(wr.orig[axis]);
+        __m256 inv = _mm256_set1_ps(wr.inv_dir[axis]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[wr.dir_is_neg[axis]][axis]), o), inv);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[1 - wr.dir_is_neg[axis]][axis]), o), inv);
+        t1 = _mm256_mul_ps(t1, _mm256_set1_ps(wide_far_scale));
+        lo = _mm256_max_ps(t0, lo);
+        hi = _mm256_min_ps(t1, hi);
+    }
+    _mm256_storeu_ps(t_near, lo);
+    return unsigned(_mm256_movemask_ps(_mm256_cmp_ps(lo, hi, _CMP_LE_OQ)));
+}
+#endif
+
+
+// The node array of an N-wide BVH and its traversals, independent of what the leaves hold.
+// Leaves refer to ranges of the primitive array the tree was built over, in the order build()
+// leaves it; callers supply the leaf intersection as a callback, so the primitives can be
+// hittables (wide_bvh) or packed triangle data (mesh).
+template <int N>
+class wide_bvh_tree {
+  public:
+    static_assert(N == 4 || N == 8, "wide_bvh supports 4 or 8 children per node");
+
+    bool empty() const { return nodes.empty(); }
+
+    size_t memory_bytes() const { return nodes.size() * sizeof(wide_bvh_node<N>); }
+
+    void build(std::vector<bvh_primitive>& prims, const bvh_build_options& options) {
+        // Build the binary tree first, then pull grandchildren up until every node is full.
+        // On return prims is in leaf order.
+        nodes.clear();
+        if (prims.empty())
+            return;
+
+        std::vector<linear_bvh_node> binary;
+        build_linear_bvh(prims, options, binary);
+
+        nodes.reserve(binary.size() / (N - 1) + 1);
+        collapse(binary, 0);
+    }
+
+    // Closest hit. leaf(first, count, ray_t) tests primitives [first, first+count), shrinks
+    // ray_t.max to any hit it finds and returns whether it found one.
+    template <typename Leaf>
+    bool closest_hit(const ray& r, interval ray_t, Leaf&& leaf) const {
+        if (nodes.empty())
+            return false;
+
+        const wide_ray wr(r);
+
+        struct entry {
+            uint32_t index;
+            uint32_t count;
+            float    t;
+        };
+
+        entry stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = { 0, 0, -std::numeric_limits<float>::infinity() };
+        bool hit_anything = false;
+
+        while (stack_size > 0) {
+            const entry e = stack[--stack_size];
+            if (e.t > float(ray_t.max) * wide_far_scale)
+                continue;
+
+            if (e.count > 0) {
+                if (leaf(e.index, e.count, ray_t))
+                    hit_anything = true;
+                continue;
+            }
+
+            const wide_bvh_node<N>& node = nodes[e.index];
+#ifdef BVH_STATS
+            bvh_node_visits++;
+#endif
+            float t_near[N];
+            unsigned mask = wide_slab_test(node, wr, float(ray_t.min), float(ray_t.max), t_near);
+
+            // Push the children far to near so the nearest is popped first.
+            int first = stack_size;
+            while (mask) {
+                int i = __builtin_ctz(mask);
+                mask &= mask - 1;
+
+                int j = stack_size++;
+                for (; j > first && stack[j-1].t < t_near[i]; j--)
+                    stack[j] = stack[j-1];
+                stack[j] = { node.child[i], node.count[i], t_near[i] };
+            }
+        }
+
+        return hit_anything;
+    }
+
+    // Any hit. leaf(first, count) returns true as soon as one primitive is hit.
+    template <typename Leaf>
+    bool any_hit(const ray& r, const interval& ray_t, Leaf&& leaf) const {
+        // Any hit ends the query, so children are pushed unsorted.
+        if (nodes.empty())
+            return false;
+
+        const wide_ray wr(r);
+        const float t_min = float(ray_t.min);
+        const float t_max = float(ray_t.max);
+
+        uint32_t stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0) {
+            const wide_bvh_node<N>& node = nodes[stack[--stack_size]];
+#ifdef BVH_STATS
+            bvh_node_visits++;
+#endif
+            float t_near[N];
+            unsigned mask = wide_slab_test(node, wr, t_min, t_max, t_near);
+
+            while (mask) {
+                int i = __builtin_ctz(mask);
+                mask &= mask - 1;
+
+                if (node.count[i] == 0)
+                    stack[stack_size++] = node.child[i];
+                else if (leaf(node.child[i], node.count[i]))
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Closest hits for a packet. leaf(first, count, lanes) tests the primitives for the given
+    // lanes, recording hits in the packet.
+    template <typename Leaf>
+    void packet_hit(ray_packet& packet, uint32_t lanes, Leaf&& leaf) const {
+        // One traversal for the whole packet over a shared stack. Every active lane runs the
+        // SIMD slab test against the node's children; a child is pushed with the lanes that
+        // enter it, ordered by the nearest entry distance among them.
+        if (nodes.empty() || !lanes)
+            return;
+
+        wide_ray wr[ray_packet::max_size];
+        for (uint32_t l = lanes; l; l &= l - 1) {
+            int i = __builtin_ctz(l);
+            wr[i] = wide_ray(packet.rays[i]);
+        }
+
+        struct entry {
+            uint32_t index;
+            uint32_t count;
+            uint32_t lanes;
+            float    t;
+        };
+
+        entry stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = { 0, 0, lanes, -std::numeric_limits<float>::infinity() };
+        const float t_min = float(packet.t_min);
+
+        while (stack_size > 0) {
+            const entry e = stack[--stack_size];
+
+            if (e.count > 0) {
+                leaf(e.index, e.count, e.lanes);
+                continue;
+            }
+
+            const wide_bvh_node<N>& node = nodes[e.index];
+#ifdef BVH_STATS
+            bvh_node_visits++;
+#endif
+            uint32_t child_lanes[N] = {};
+            float child_t[N];
+            for (int c = 0; c < N; c++)
+                child_t[c] = std::numeric_limits<float>::infinity();
+
+            for (uint32_t l = e.lanes; l; l &= l - 1) {
+                int i = __builtin_ctz(l);
+                float t_near[N];
+                unsigned mask = wide_slab_test(node, wr[i], t_min, float(packet.t_max[i]), t_near);
+                for (; mask; mask &= mask - 1) {
+                    int c = __builtin_ctz(mask);
+                    child_lanes[c] |= 1u << i;
+                    child_t[c] = std::fmin(child_t[c], t_near[c]);
+                }
+            }
+
+            // Push the children far to near so the nearest is popped first.
+            int first = stack_size;
+            for (int c = 0; c < N; c++) {
+                if (!child_lanes[c]) continue;
+
+                int j = stack_size++;
+                for (; j > first && stack[j-1].t < child_t[c]; j--)
+                    stack[j] = stack[j-1];
+                stack[j] = { node.child[c], node.count[c], child_lanes[c], child_t[c] };
+            }
+        }
+    }
+
+  private:
+    // A wide node is at least one binary level below its parent, so none is deeper than the
+    // binary tree's bvh_max_depth; the stacks hold the up to N-1 unvisited siblings of each
+    // node on the current path, plus the children of the node being visited.
+    static constexpr int stack_capacity = (N - 1) * bvh_max_depth + 1;
+
+    std::vector<wide_bvh_node<N>> nodes;
+
+    static float binary_area(const linear_bvh_node& node) {
+        float dx = node.bounds[1][0] - node.bounds[0][0];
+        float dy = node.bounds[1][1] - node.bounds[0][1];
+        float dz = node.bounds[1][2] - node.bounds[0][2];
+        return dx*dy + dy*dz + dz*dx;
+    }
+
+    uint32_t collapse(const std::vector<linear_bvh_node>& binary, uint32_t root) {
+        // Gathers up to N descendants of binary[root] by repeatedly opening the largest inner
+        // candidate, then emits them as the children of one wide node.
+        uint32_t slots[N];
+        int used = 0;
+
+        if (binary[root].count > 0) {
+            slots[used++] = root;
+        } else {
+            slots[used++] = root + 1;
+            slots[used++] = binary[root].offset;
+        }
+
+        while (used < N) {
+            int best = -1;
+            for (int i = 0; i < used; i++) {
+                if (binary[slots[i]].count > 0) continue;
+                if (best < 0 || binary_area(binary[slots[i]]) > binary_area(binary[slots[best]]))
+                    best = i;
+            }
+            if (best < 0) break;
+
+            auto opened = slots[best];
+            slots[best] = opened + 1;
+            slots[used++] = binary[opened].offset;
+        }
+
+        uint32_t index = uint32_t(nodes.size());
+        nodes.emplace_back();
+        for (int i = 0; i < N; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                nodes[index].bounds[0][axis][i] = std::numeric_limits<float>::infinity();
+                nodes[index].bounds[1][axis][i] = -std::numeric_limits<float>::infinity();
+            }
+        }
+
+        for (int i = 0; i < used; i++) {
+            const linear_bvh_node& b = binary[slots[i]];
+            for (int axis = 0; axis < 3; axis++) {
+                nodes[index].bounds[0][axis][i] = b.bounds[0][axis];
+                nodes[index].bounds[1][axis][i] = b.bounds[1][axis];
+            }
+
+            if (b.count > 0) {
+                nodes[index].child[i] = b.offset;
+                nodes[index].count[i] = b.count;
+            } else {
+                auto child = collapse(binary, slots[i]);
+                nodes[index].child[i] = child;
+                nodes[index].count[i] = 0;
+            }
+        }
+
+        return index;
+    }
+};
+
+
+
+template <int N>
+class wide_bvh : public hittable {
+  public:
+    wide_bvh(const hittable_list& list, const bvh_build_options& options = {}) {
+        auto prims = bvh_primitives(list.objects);
+        if (prims.empty())
+            return;
+
+        tree.build(prims, options);
+
+        primitives.reserve(prims.size());
+        for (const auto& p : prims)
+            primitives.push_back(list.objects[p.index]);
+        bbox = list.bounding_box();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!intersect(r, ray_t, rec))
+            return false;
+        finalize_hit(r, rec);
+        return true;
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        return tree.closest_hit(r, ray_t, [&](uint32_t first, uint32_t count, interval& t) {
+            bool hit_anything = false;
+            for (uint32_t i = first; i < first + count; i++) {
+                if (primitives[i]->intersect(r, t, rec)) {
+                    hit_anything = true;
+                    t.max = rec.t;
+                }
+            }
+            return hit_anything;
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return tree.any_hit(r, ray_t, [&](uint32_t first, uint32_t count) {
+            for (uint32_t i = first; i < first + count; i++) {
+                if (primitives[i]->occluded(r, ray_t))
+                    return true;
+            }
+            return false;
+        });
+    }
+
+    void hit_packet(ray_packet& packet, uint32_t lanes, hit_record recs[]) const override {
+        tree.packet_hit(packet, lanes, [&](uint32_t first, uint32_t count, uint32_t leaf_lanes) {
+            for (uint32_t i = first; i < first + count; i++)
+                primitives[i]->hit_packet(packet, leaf_lanes, recs);
+        });
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+  private:
+    wide_bvh_tree<N> tree;
+    std::vector<shared_ptr<hittable>> primitives;
+    aabb bbox;
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+#endif
@@ -5,11 +5,172 @@
 #include "../include/camera.h"
 #include "../include/material.h"
 #include "../include/bvh.h"
+#include "../include/linear_bvh.h"
+#include "../include/wide_bvh.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <new>
 #include <thread>
 
 
+// Counts every heap allocation, so the render loop can be checked for per-sample allocations.
+std::atomic<unsigned long long> allocation_count{0};
+
+// The replacements form a matched set: every form of new, single and array, allocates with
+// counted_allocate, and every form of delete releases with counted_release.
+void* counted_allocate(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void counted_release(void* p) noexcept { std::free(p); }
+
+void* operator new(std::size_t size) { return counted_allocate(size); }
+void* operator new[](std::size_t size) { return counted_allocate(size); }
+
+void operator delete(void* p) noexcept { counted_release(p); }
+void operator delete[](void* p) noexcept { counted_release(p); }
+void operator delete(void* p, std::size_t) noexcept { counted_release(p); }
+void operator delete[](void* p, std::size_t) noexcept { counted_release(p); }
+
+
+// Rays from the camera position towards random points on the sphere field.
+std::vector<ray> benchmark_rays(const point3& origin, int count) {
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for (int i = 0; i < count; i++) {
+        auto target = point3(random_double(-11, 11), random_double(0, 1), random_double(-11, 11));
+        rays.emplace_back(origin, target - origin);
+    }
+    return rays;
+}
+
+// Primary rays through a width x height grid on the view plane, row by row, like the rays of
+// one sample of a render.
+std::vector<ray> primary_rays(const point3& lookfrom, const point3& lookat, int width, int height) {
+    auto w = unit_vector(lookfrom - lookat);
+    auto u = unit_vector(cross(vec3(0,1,0), w));
+    auto v = cross(w, u);
+    auto half_height = std::tan(degrees_to_radians(20) / 2);
+    auto half_width = half_height * width / height;
+
+    std::vector<ray> rays;
+    rays.reserve(width * height);
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            auto x = (2 * (i + random_double()) / width - 1) * half_width;
+            auto y = (1 - 2 * (j + random_double()) / height) * half_height;
+            rays.emplace_back(lookfrom, x * u + y * v - w);
+        }
+    }
+    return rays;
+}
+
+// Traces `rays` in packets of `width` consecutive rays.
+void packet_benchmark(const char* name, const hittable& world, const std::vector<ray>& rays,
+                      int width) {
+    int hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t first = 0; first < rays.size(); first += width) {
+        ray_packet packet;
+        for (size_t i = first; i < std::min(rays.size(), first + width); i++)
+            packet.add(rays[i]);
+
+        hit_record recs[ray_packet::max_size];
+        world.hit_packet(packet, packet.all(), recs);
+        hits += __builtin_popcount(packet.hits);
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto seconds = std::chrono::duration<double>(stop - start).count();
+
+    std::cout << name << " x" << width << ": " << rays.size() / seconds / 1e6 << " Mrays/s"
+              << " (" << hits << " hits)\n";
+}
+
+// Reports closest-hit throughput over `rays`. This isolates the acceleration structure from
+// shading.
+void trace_benchmark(const char* name, const hittable& world, const std::vector<ray>& rays) {
+    auto count = rays.size();
+
+#ifdef BVH_STATS
+    bvh_node_visits = 0;
+#endif
+    int hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const auto& r : rays) {
+        hit_record rec;
+        if (world.hit(r, interval(0.001, infinity), rec))
+            hits++;
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto seconds = std::chrono::duration<double>(stop - start).count();
+
+    std::cout << name << ": " << count / seconds / 1e6 << " Mrays/s"
+              << " (" << hits << " hits";
+#ifdef BVH_STATS
+    std::cout << ", " << double(bvh_node_visits) / count << " node visits/ray";
+#endif
+    std::cout << ")\n";
+}
+
+// Rays from points just above the ground towards random points on the sun. Each ray ends at
+// t = 1, on the light itself.
+std::vector<ray> shadow_rays(const point3& sun, double radius, int count) {
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for (int i = 0; i < count; i++) {
+        auto origin = point3(random_double(-11, 11), 0.01, random_double(-11, 11));
+        rays.emplace_back(origin, sun + radius * random_unit_vector() - origin);
+    }
+    return rays;
+}
+
+// Compares answering shadow-ray visibility with a closest-hit query against the any-hit
+// occluded() query.
+void shadow_benchmark(const char* name, const hittable& world, const std::vector<ray>& rays) {
+    const interval unoccluded(0.001, 0.999);
+    int blocked_hit = 0, blocked_any = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const auto& r : rays) {
+        hit_record rec;
+        if (world.hit(r, unoccluded, rec))
+            blocked_hit++;
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    for (const auto& r : rays) {
+        if (world.occluded(r, unoccluded))
+            blocked_any++;
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    auto count = rays.size();
+    std::cout << name << " shadow rays: hit " << count / std::chrono::duration<double>(mid - start).count() / 1e6
+              << " Mrays/s, occluded " << count / std::chrono::duration<double>(stop - mid).count() / 1e6
+              << " Mrays/s (" << blocked_any << " blocked";
+    if (blocked_hit != blocked_any)
+        std::cout << ", MISMATCH " << blocked_hit;
+    std::cout << ")\n";
+}
+
+shared_ptr<hittable> build_bvh(const char* name, const hittable_list& world, bvh_split_method method) {
+    bvh_build_options options;
+    options.method = method;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    auto bvh = make_shared<bvh_node>(world, options);
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    std::cout << name << " build: "
+              << std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count()
+              << " microseconds\n";
+    return bvh;
+}
 
 int main() {
 
@@ -20,6 +181,7 @@ int main() {
 
     if (num_threads == 0) {
         std::cout << "Unable to determine number of threads\n";
+        num_threads = 1;
     }
     else
     {
@@ -68,6 +230,50 @@ int main() {
     auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
     world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
 
+    auto sun = make_shared<diffuse_light>(color(15, 15, 15));
+    world.add(make_shared<sphere>(point3(0, 20, 0), 3.0, sun));
+
+    hittable_list lights;
+    lights.add(make_shared<sphere>(point3(0, 20, 0), 3.0, nullptr));
+
+
+    auto lookfrom = point3(13,2,3);
+    auto median_bvh = build_bvh("median", world, bvh_split_method::median);
+    auto sah_bvh = build_bvh("sah", world, bvh_split_method::sah);
+
+
+    auto start_flat = std::chrono::high_resolution_clock::now();
+    auto linear = make_shared<linear_bvh>(world);
+    auto stop_flat = std::chrono::high_resolution_clock::now();
+    std::cout << "linear build: "
+              << std::chrono::duration_cast<std::chrono::microseconds>(stop_flat - start_flat).count()
+              << " microseconds\n";
+    auto flattened = make_shared<linear_bvh>(*std::static_pointer_cast<bvh_node>(sah_bvh));
+    auto wide4 = make_shared<bvh4>(world);
+    auto wide8 = make_shared<bvh8>(world);
+
+    auto rays = benchmark_rays(lookfrom, 1000000);
+    trace_benchmark("median", *median_bvh, rays);
+    trace_benchmark("sah", *sah_bvh, rays);
+    trace_benchmark("sah flattened", *flattened, rays);
+    trace_benchmark("linear", *linear, rays);
+    trace_benchmark("bvh4", *wide4, rays);
+    trace_benchmark("bvh8", *wide8, rays);
+
+    auto primaries = primary_rays(lookfrom, point3(0,0,0), 1600, 900);
+    trace_benchmark("bvh4 primary", *wide4, primaries);
+    for (int width : {4, 8, 16})
+        packet_benchmark("bvh4 primary", *wide4, primaries, width);
+    trace_benchmark("bvh8 primary", *wide8, primaries);
+    for (int width : {4, 8, 16})
+        packet_benchmark("bvh8 primary", *wide8, primaries, width);
+
+    auto shadows = shadow_rays(point3(0, 20, 0), 3.0, 1000000);
+    shadow_benchmark("sah", *sah_bvh, shadows);
+    shadow_benchmark("linear", *linear, shadows);
+    shadow_benchmark("bvh4", *wide4, shadows);
+    shadow_benchmark("bvh8", *wide8, shadows);
+
 
     camera cam;
 
@@ -75,28 +281,37 @@ int main() {
     cam.image_width       = 400;
     cam.samples_per_pixel = 100;
     cam.max_depth         = 50;
+    cam.background        = color(0.70, 0.80, 1.00);
 
     cam.vfov     = 20;
-    cam.lookfrom = point3(13,2,3);
+    cam.lookfrom = lookfrom;
     cam.lookat   = point3(0,0,0);
     cam.vup      = vec3(0,1,0);
 
     cam.defocus_angle = 0.6;
     cam.focus_dist    = 10.0;
 
-    cam.render(world, num_threads);
+    auto allocations_before = allocation_count.load();
+    cam.render(*linear, num_threads, lights);
+    auto allocations = allocation_count.load() - allocations_before;
+
+    // Whatever remains is per-row and per-pixel bookkeeping in render, not per-sample work.
+    auto samples = double(cam.image_width) * int(cam.image_width / cam.aspect_ratio)
+                 * cam.samples_per_pixel;
+    std::cout << "Render allocations: " << allocations << " ("
+              << allocations / samples << " per sample)\n";
 
     // Get ending timepoint
     auto stop = std::chrono::high_resolution_clock::now();
- 
-    // Get duration. Substart timepoints to 
+
+    // Get duration. Substart timepoints to
     // get duration. To cast it to proper unit
     // use duration cast method
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
- 
+
     std::cout << "Time taken by function: "
          << duration.count() << " microseconds" << std::endl;
- 
+
     return 0;
 
 
@@ -7,17 +7,27 @@
 #include "../include/constant_medium.h"
 #include "../include/material.h"
 #include "../include/bvh.h"
+#include "../include/linear_bvh.h"
+#include "../include/wide_bvh.h"
+#include "../include/instance.h"
 #include "../include/texture.h"
 #include "../include/mesh.h"
 #include "../include/triangle.h"
+#include "../include/wavefront.h"
 
 #include <lua.hpp>
 #include <string>
 #include <stdexcept>
 #include <map>
 #include <chrono>
+#include <cmath>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <thread>
+#include <vector>
+
+using std::string;
 
 // Helper functions for Lua table parsing
 shared_ptr<material> create_material_from_lua(lua_State* L, int material_idx) {
@@ -92,6 +102,31 @@ vec3 get_vec3_from_lua(lua_State* L, int table_idx) {
     return get_point3_from_lua(L, table_idx);
 }
 
+shared_ptr<mesh> load_mesh(const string& path, shared_ptr<material> mat) {
+    // Reports what was loaded; returns null if the file has no triangles.
+    auto m = make_shared<mesh>(path, mat);
+    std::cout << "Loaded " << m->size() << " triangles from " << path
+              << " (BVH built in " << m->bvh_build_time() * 1000 << " ms, "
+              << m->memory_bytes() / 1024 << " KiB)" << std::endl;
+    if (m->size() == 0)
+        return nullptr;
+    return m;
+}
+
+shared_ptr<mesh> load_shared_mesh(const string& path, shared_ptr<material> mat) {
+    // Instances of the same OBJ file share one mesh and its BVH. The mesh keeps the material
+    // of the first instance that loaded it; every instance applies its own on top.
+    static std::map<string, shared_ptr<mesh>> meshes;
+
+    auto found = meshes.find(path);
+    if (found != meshes.end())
+        return found->second;
+
+    auto m = load_mesh(path, mat);
+    meshes[path] = m;
+    return m;
+}
+
 shared_ptr<hittable> create_object_from_lua(lua_State* L, int obj_idx, const std::map<string, shared_ptr<material>>& materials, bool is_light = false) {
     lua_rawgeti(L, -1, 1); // Get object type
     const char* type_str = lua_tostring(L, -1);
@@ -198,11 +233,115 @@ shared_ptr<hittable> create_object_from_lua(lua_State* L, int obj_idx, const std
             }
         }
     }
-    
+    else if (obj_type == "mesh" && !is_light) {
+        lua_rawgeti(L, -1, 2); // Get OBJ file path
+        const char* path_str = lua_tostring(L, -1);
+        if (!path_str) {
+            std::cout << "File path for mesh at index " << obj_idx << " is null" << std::endl;
+            lua_pop(L, 1);
+            return nullptr;
+        }
+        string path(path_str);
+        lua_pop(L, 1);
+
+        lua_rawgeti(L, -1, 3); // Get material id
+        const char* id_str = lua_tostring(L, -1);
+        if (!id_str) {
+            std::cout << "Material ID for mesh at index " << obj_idx << " is null" << std::endl;
+            lua_pop(L, 1);
+            return nullptr;
+        }
+        string mat_id(id_str);
+        lua_pop(L, 1);
+
+        try {
+            return load_mesh(path, materials.at(mat_id));
+        } catch (const std::out_of_range& e) {
+            std::cout << "Material '" << mat_id << "' not found for mesh at index " << obj_idx << std::endl;
+            return nullptr;
+        }
+    }
+    else if (obj_type == "instance" && !is_light) {
+        lua_rawgeti(L, -1, 2); // Get OBJ file path
+        const char* path_str = lua_tostring(L, -1);
+        if (!path_str) {
+            std::cout << "File path for instance at index " << obj_idx << " is null" << std::endl;
+            lua_pop(L, 1);
+            return nullptr;
+        }
+        string path(path_str);
+        lua_pop(L, 1);
+
+        lua_rawgeti(L, -1, 3); // Get translation
+        vec3 offset = get_vec3_from_lua(L, -1);
+        lua_pop(L, 1);
+
+        lua_rawgeti(L, -1, 4); // Get rotation in degrees about x, y, z (applied in that order)
+        vec3 angles = get_vec3_from_lua(L, -1);
+        lua_pop(L, 1);
+
+        lua_rawgeti(L, -1, 5); // Get uniform scale (optional, default 1)
+        double scale = lua_isnil(L, -1) ? 1.0 : lua_tonumber(L, -1);
+        lua_pop(L, 1);
+        if (!std::isfinite(scale) || scale == 0) {
+            std::cout << "Scale for instance at index " << obj_idx << " is not a nonzero number"
+                      << std::endl;
+            return nullptr;
+        }
+
+        lua_rawgeti(L, -1, 6); // Get material id
+        const char* id_str = lua_tostring(L, -1);
+        if (!id_str) {
+            std::cout << "Material ID for instance at index " << obj_idx << " is null" << std::endl;
+            lua_pop(L, 1);
+            return nullptr;
+        }
+        string mat_id(id_str);
+        lua_pop(L, 1);
+
+        try {
+            auto mat = materials.at(mat_id);
+            auto shared = load_shared_mesh(path, mat);
+            if (!shared)
+                return nullptr;
+
+            auto object_to_world = affine::translation(offset)
+                                 * affine::rotation(2, angles.z())
+                                 * affine::rotation(1, angles.y())
+                                 * affine::rotation(0, angles.x())
+                                 * affine::scaling(vec3(scale, scale, scale));
+            return make_shared<instance>(shared, object_to_world, mat);
+        } catch (const std::out_of_range& e) {
+            std::cout << "Material '" << mat_id << "' not found for instance at index " << obj_idx << std::endl;
+            return nullptr;
+        }
+    }
+
     return nullptr;
 }
 
-void create_scene_from_lua(lua_State* L, hittable_list& world, hittable_list& lights, camera& cam) {
+shared_ptr<hittable> build_accelerator(const string& type, const hittable_list& objects) {
+    // Wraps the scene objects in the acceleration structure named by SceneSettings.accelerator.
+    if (type == "bvh4")
+        return make_shared<bvh4>(objects);
+    if (type == "bvh8")
+        return make_shared<bvh8>(objects);
+    if (type == "linear")
+        return make_shared<linear_bvh>(objects);
+
+    bvh_build_options options;
+    if (type == "sah")
+        return make_shared<bvh_node>(objects, options);
+    if (type == "median") {
+        options.method = bvh_split_method::median;
+        return make_shared<bvh_node>(objects, options);
+    }
+
+    throw std::runtime_error("Unknown accelerator '" + type + "'");
+}
+
+void create_scene_from_lua(lua_State* L, hittable_list& world, hittable_list& lights, camera& cam,
+                           string& renderer, bool& wavefront_sort) {
     // Parse SceneSettings
     lua_getglobal(L, "SceneSettings");
     if (!lua_istable(L, -1)) {
@@ -254,6 +393,111 @@ void create_scene_from_lua(lua_State* L, hittable_list& world, hittable_list& li
     cam.background = get_vec3_from_lua(L, -1);
     lua_pop(L, 1);
 
+    // Optional: "sobol" (default), "blue_noise" or "independent"
+    lua_getfield(L, -1, "sampler");
+    if (lua_isstring(L, -1)) {
+        cam.sampler = lua_tostring(L, -1);
+        sampler_type_from_name(cam.sampler);  // reject unknown names before rendering
+    }
+    lua_pop(L, 1);
+
+    // Optional: "path" (default) or "wavefront"
+    lua_getfield(L, -1, "renderer");
+    if (lua_isstring(L, -1))
+        renderer = lua_tostring(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, -1, "wavefront_sort");
+    if (lua_isboolean(L, -1))
+        wavefront_sort = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, -1, "packet_size");
+    if (lua_isnumber(L, -1))
+        cam.packet_size = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    // Optional: tile edge in pixels (0 renders by scanline) and "hilbert", "morton" or "scanline"
+    lua_getfield(L, -1, "tile_size");
+    if (lua_isnumber(L, -1))
+        cam.tile_size = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, -1, "pixel_order");
+    if (lua_isstring(L, -1)) {
+        cam.pixel_order = lua_tostring(L, -1);
+        tile_pixel_order(1, cam.pixel_order);  // reject unknown names before rendering
+    }
+    lua_pop(L, 1);
+
+    // Optional: estimate tile costs from a timed one-sample pass and split the expensive tiles
+    lua_getfield(L, -1, "cost_prepass");
+    if (lua_isboolean(L, -1))
+        cam.cost_prepass = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    // Optional: "text" (default), "json" or "none", reported every progress_interval seconds
+    lua_getfield(L, -1, "progress");
+    if (lua_isstring(L, -1))
+        cam.progress_mode = lua_tostring(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, -1, "progress_interval");
+    if (lua_isnumber(L, -1))
+        cam.progress_interval = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    // Optional: samples per pixel in each pass of a progressive (--time or --checkpoint) render
+    lua_getfield(L, -1, "pass_samples");
+    if (lua_isnumber(L, -1))
+        cam.pass_samples = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    // Optional: stop sampling pixels once their relative standard error is below the threshold,
+    // spending the saved samples on the noisy ones, and write the samples each pixel took
+    lua_getfield(L, -1, "adaptive_threshold");
+    if (lua_isnumber(L, -1))
+        cam.adaptive_threshold = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, -1, "adaptive_min_samples");
+    if (lua_isnumber(L, -1))
+        cam.adaptive_min_samples = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, -1, "adaptive_max_samples");
+    if (lua_isnumber(L, -1))
+        cam.adaptive_max_samples = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, -1, "sample_map");
+    if (lua_isstring(L, -1)) {
+        cam.sample_map_path = lua_tostring(L, -1);
+        image_format_from_path(cam.sample_map_path);  // reject unknown extensions before rendering
+    }
+    lua_pop(L, 1);
+
+    // Optional: write bands of this many rows as they finish instead of keeping the whole image
+    lua_getfield(L, -1, "stream_band_rows");
+    if (lua_isnumber(L, -1))
+        cam.stream_band_rows = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    // Optional: "p3", "ppm", "pfm" or "qoi"; by default the output file's extension decides
+    lua_getfield(L, -1, "output_format");
+    if (lua_isstring(L, -1)) {
+        cam.output_format = lua_tostring(L, -1);
+        image_format_from_name(cam.output_format);  // reject unknown names before rendering
+    }
+    lua_pop(L, 1);
+
+    // Optional: "bvh4" (default), "bvh8", "linear", "sah", "median" or "none"
+    string accelerator = "bvh4";
+    lua_getfield(L, -1, "accelerator");
+    if (lua_isstring(L, -1))
+        accelerator = lua_tostring(L, -1);
+    lua_pop(L, 1);
+
     // Create materials map
     lua_getglobal(L, "Materials");
     if (!lua_istable(L, -1)) {
@@ -293,14 +537,29 @@ void create_scene_from_lua(lua_State* L, hittable_list& world, hittable_list& li
     int objects_len = lua_rawlen(L, -1);
     std::cout << "Found Objects table with " << objects_len << " objects" << std::endl;
 
+    hittable_list objects;
     for (int i = 1; i <= objects_len; i++) {
         lua_rawgeti(L, -1, i);
         auto obj = create_object_from_lua(L, i, materials, false);
-        if (obj) world.add(obj);
+        if (obj) objects.add(obj);
         lua_pop(L, 1);
     }
     lua_pop(L, 1);
 
+    // Meshes and instances keep their own hierarchies; the top level is built over every object.
+    if (accelerator == "none" || objects.objects.empty()) {
+        world = objects;
+        std::cout << "Tracing " << objects.objects.size() << " objects without an accelerator"
+                  << std::endl;
+    } else {
+        auto start = std::chrono::steady_clock::now();
+        world.add(build_accelerator(accelerator, objects));
+        auto stop = std::chrono::steady_clock::now();
+        std::cout << "Built " << accelerator << " over " << objects.objects.size() << " objects in "
+                  << std::chrono::duration<double, std::milli>(stop - start).count() << " ms"
+                  << std::endl;
+    }
+
     // Create lights
     lua_getglobal(L, "Lights");
     if (!lua_istable(L, -1)) {
@@ -318,7 +577,18 @@ void create_scene_from_lua(lua_State* L, hittable_list& world, hittable_list& li
     lua_pop(L, 1);
 }
 
-void initialize_lua(const char* scene_name) {
+// Command-line settings that override the scene's.
+struct render_options {
+    string output_path = "image.ppm";
+    int samples = 0;           // samples per pixel; 0 keeps the scene's
+    double time_budget = 0;    // seconds; 0 for no limit
+    int pass_samples = 0;      // per progressive pass; 0 keeps the scene's
+    string checkpoint_path;
+    double checkpoint_interval = 60;
+    bool resume = false;
+};
+
+void initialize_lua(const char* scene_name, const render_options& options) {
     // Get starting timepoint
     auto start = std::chrono::high_resolution_clock::now();
     
@@ -342,11 +612,42 @@ void initialize_lua(const char* scene_name) {
     hittable_list world;
     hittable_list lights;
     camera cam;
-
-    create_scene_from_lua(L, world, lights, cam);
+    cam.output_path = options.output_path;
+    string renderer = "path";
+    bool wavefront_sort = false;
+
+    auto scene_start = std::chrono::steady_clock::now();
+    create_scene_from_lua(L, world, lights, cam, renderer, wavefront_sort);
+    if (options.samples > 0)
+        cam.samples_per_pixel = options.samples;
+    cam.time_budget = options.time_budget;
+    if (options.pass_samples > 0)
+        cam.pass_samples = options.pass_samples;
+    cam.checkpoint_path = options.checkpoint_path;
+    cam.checkpoint_interval = options.checkpoint_interval;
+    cam.resume = options.resume;
+    // Checkpoints are tied to the scene file's contents, so editing the scene retires them.
+    std::ifstream scene_file("src/scenes/" + string(scene_name) + ".lua", std::ios::binary);
+    std::ostringstream scene_text;
+    scene_text << scene_file.rdbuf();
+    cam.checkpoint_tag = string(scene_name) + '\n' + scene_text.str();
+    if (cam.output_format.empty())
+        image_format_from_path(cam.output_path);  // reject unknown extensions before rendering
+    auto scene_stop = std::chrono::steady_clock::now();
+    std::cout << "Scene built in "
+              << std::chrono::duration<double>(scene_stop - scene_start).count() << " s" << std::endl;
     
     // Render the scene
-    cam.render(world, std::thread::hardware_concurrency(), lights);
+    auto render_start = std::chrono::steady_clock::now();
+    if (renderer == "wavefront") {
+        wavefront_renderer wavefront(cam);
+        wavefront.sort_rays = wavefront_sort;
+        wavefront.render(world, std::thread::hardware_concurrency(), lights);
+    } else
+        cam.render(world, std::thread::hardware_concurrency(), lights);
+    auto render_stop = std::chrono::steady_clock::now();
+    std::cout << "Rendered in "
+              << std::chrono::duration<double>(render_stop - render_start).count() << " s" << std::endl;
     
     lua_close(L);
 
@@ -361,13 +662,46 @@ void initialize_lua(const char* scene_name) {
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <scene_name>" << std::endl;
+    const char* usage = " <scene_name> [output.ppm|.pfm|.qoi] [--samples N] [--time SECONDS]"
+                        " [--pass-samples N]"
+                        " [--checkpoint PATH [--checkpoint-interval SECONDS] [--resume]]";
+    render_options options;
+    std::vector<string> positional;
+
+    try {
+        for (int k = 1; k < argc; k++) {
+            string arg = argv[k];
+            bool has_value = k + 1 < argc;
+            if (arg == "--samples" && has_value)
+                options.samples = std::stoi(argv[++k]);
+            else if (arg == "--time" && has_value)
+                options.time_budget = std::stod(argv[++k]);
+            else if (arg == "--pass-samples" && has_value)
+                options.pass_samples = std::stoi(argv[++k]);
+            else if (arg == "--checkpoint" && has_value)
+                options.checkpoint_path = argv[++k];
+            else if (arg == "--checkpoint-interval" && has_value)
+                options.checkpoint_interval = std::stod(argv[++k]);
+            else if (arg == "--resume")
+                options.resume = true;
+            else if (arg.rfind("--", 0) == 0)
+                throw std::invalid_argument("unknown or incomplete option " + arg);
+            else
+                positional.push_back(arg);
+        }
+        if (positional.empty() || positional.size() > 2)
+            throw std::invalid_argument("expected a scene name and an optional output path");
+        if (options.resume && options.checkpoint_path.empty())
+            throw std::invalid_argument("--resume needs --checkpoint");
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\nUsage: " << argv[0] << usage << std::endl;
         return 1;
     }
+    if (positional.size() > 1)
+        options.output_path = positional[1];
 
     try {
-        initialize_lua(argv[1]);
+        initialize_lua(positional[0].c_str(), options);
     } catch (const std::exception& e) {
         std::cerr << "Lua initialization error: " << e.what() << std::endl;
         return 1;
@@ -0,0 +1,56 @@
+local M = {}
+
+-- Field parameters
+local rows = 50
+local spacing = 3.2
+
+function M.setup()
+    -- Scene Settings
+    SceneSettings = {
+        aspect_ratio = 16/9,
+        image_width = 600,
+        samples_per_pixel = 16,
+        max_depth = 12,
+        vfov = 40,
+        lookfrom = {0, 18, 60},
+        lookat = {0, 0, 0},
+        vup = {0, 1, 0},
+        defocus_angle = 0.0,
+        focus_dist = 60.0,
+        background = {0.55, 0.65, 0.8}
+    }
+
+    -- Materials
+    local ground = {"lambertian", {0.35, 0.3, 0.25}}
+    local porcelain = {"lambertian", {0.85, 0.85, 0.8}}
+    local copper = {"metal", {0.8, 0.5, 0.3}, 0.2}
+    local glass = {"dielectric", 1.5}
+    local sun = {"diffuse_light", {12, 11, 9}}
+
+    table.insert(Materials, {"ground", table.unpack(ground)})
+    table.insert(Materials, {"porcelain", table.unpack(porcelain)})
+    table.insert(Materials, {"copper", table.unpack(copper)})
+    table.insert(Materials, {"glass", table.unpack(glass)})
+    table.insert(Materials, {"sun", table.unpack(sun)})
+
+    table.insert(Objects, {"quad", {-200, 0, -200}, {400, 0, 0}, {0, 0, 400}, "ground"})
+
+    table.insert(Objects, {"quad", {-20, 60, -20}, {40, 0, 0}, {0, 0, 40}, "sun"})
+    table.insert(Lights, {"quad", {-20, 60, -20}, {40, 0, 0}, {0, 0, 40}})
+
+    -- Every cup is an instance of the same mesh, so only one copy of it is kept in memory
+    local finishes = {"porcelain", "porcelain", "copper", "glass"}
+    math.randomseed(7)
+    for i = 1, rows do
+        for j = 1, rows do
+            local x = (i - rows / 2) * spacing + math.random() - 0.5
+            local z = (j - rows / 2) * spacing + math.random() - 0.5
+            local finish = finishes[math.random(#finishes)]
+            table.insert(Objects, {"instance", "meshes/cup_small.obj",
+                                   {x, 0, z}, {0, math.random() * 360, 0}, 0.8 + 0.4 * math.random(),
+                                   finish})
+        end
+    end
+end
+
+return M